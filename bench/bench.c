@@ -0,0 +1,195 @@
+// Times every core flow.h operator against a hand-written loop doing the same work, for sizes
+// 1e3..1e9 (decades) and several element types. Output is CSV (see bench.h).
+//
+// Build and run from the repository root:
+//   gcc -O3 -march=native -o /tmp/flow_bench bench/bench.c -lm
+//   /tmp/flow_bench [--min 1e3] [--max 1e7] [--ops map,sum] [--types f64] [--counters] > results.csv
+//   /tmp/flow_bench --max 1e6 --save base.json > /dev/null        # record a baseline
+//   /tmp/flow_bench --max 1e6 --compare base.json > /dev/null     # exit 1 on regressions
+//
+// Large sizes need memory: --max 1e9 with f64 allocates several 8 GB buffers.
+
+#include "bench.h"
+
+// Input values are uniform in [0, BENCH_RANGE), so "x < sel * BENCH_RANGE / 100" keeps sel%.
+#define BENCH_RANGE 1000
+// Inner length of the iterators fed to iter_flatten.
+#define BENCH_CHUNK 64
+// iter_unique compares against every value kept so far; inputs use this many distinct values.
+#define BENCH_DISTINCT 256
+
+static unsigned long long bench_rng = 0x9E3779B97F4A7C15ull;
+
+static inline unsigned bench_rand(void) {
+    bench_rng ^= bench_rng << 13;
+    bench_rng ^= bench_rng >> 7;
+    bench_rng ^= bench_rng << 17;
+    return (unsigned)(bench_rng >> 32);
+}
+
+/**
+ * @brief Define bench_<name>(n), which times every operator for element type T at size n.
+ * @param T The element type.
+ * @param name Short type name used in the output and in --types.
+ */
+#define BENCH_DEFINE_TYPE(T, name) \
+    typedef struct { T a, b; } bench_pair_##name; \
+    static void bench_##name(size_t n) { \
+        const char *tn = #name; \
+        size_t bytes = n * sizeof(T); \
+        T *src = _flow_alloc(FLOW_OP_OTHER, bytes), *src2 = _flow_alloc(FLOW_OP_OTHER, bytes), *small = _flow_alloc(FLOW_OP_OTHER, bytes); \
+        for (size_t i = 0; i < n; ++i) { \
+            src[i] = (T)(bench_rand() % BENCH_RANGE); \
+            src2[i] = (T)(bench_rand() % BENCH_RANGE); \
+            small[i] = (T)(bench_rand() % BENCH_DISTINCT); \
+        } \
+        Iterator in = { .data = src, .len = n, .elem_size = sizeof(T), .align = FLOW_ALIGN }; \
+        Iterator in2 = { .data = src2, .len = n, .elem_size = sizeof(T), .align = FLOW_ALIGN }; \
+        Iterator in_small = { .data = small, .len = n, .elem_size = sizeof(T), .align = FLOW_ALIGN }; \
+        size_t nchunks = (n + BENCH_CHUNK - 1) / BENCH_CHUNK; \
+        Iterator *chunks = malloc(nchunks * sizeof(Iterator)); \
+        for (size_t c = 0; c < nchunks; ++c) { \
+            size_t lo = c * BENCH_CHUNK, hi = lo + BENCH_CHUNK < n ? lo + BENCH_CHUNK : n; \
+            chunks[c] = (Iterator){ .data = src + lo, .len = hi - lo, .elem_size = sizeof(T), .align = 0 }; \
+        } \
+        Iterator nested = { .data = chunks, .len = nchunks, .elem_size = sizeof(Iterator), .align = 0 }; \
+        \
+        BENCH("map", tn, n, "flow", 2 * bytes, { \
+            Iterator r = iter_map(in, T, x, T, x * (T)3 + (T)1); BENCH_ESCAPE(r.data); iter_free(r); }); \
+        BENCH("map", tn, n, "baseline", 2 * bytes, { \
+            T *r = malloc(bytes); \
+            for (size_t i = 0; i < n; ++i) r[i] = src[i] * (T)3 + (T)1; \
+            BENCH_ESCAPE(r); free(r); }); \
+        \
+        static const int sels[] = { 1, 50, 99 }; \
+        for (int s = 0; s < 3; ++s) { \
+            char op[16]; \
+            snprintf(op, sizeof(op), "filter_%d", sels[s]); \
+            T cut = (T)(sels[s] * BENCH_RANGE / 100); \
+            size_t kept_bytes = bytes * sels[s] / 100; \
+            BENCH(op, tn, n, "flow", bytes + kept_bytes, { \
+                Iterator r = iter_filter(in, T, x, x < cut); BENCH_ESCAPE(r.data); iter_free(r); }); \
+            BENCH(op, tn, n, "baseline", bytes + kept_bytes, { \
+                T *r = malloc(bytes); \
+                size_t k = 0; \
+                for (size_t i = 0; i < n; ++i) if (src[i] < cut) r[k++] = src[i]; \
+                BENCH_ESCAPE(r); free(r); }); \
+        } \
+        \
+        BENCH("sum", tn, n, "flow", bytes, { T r = iter_sum(in, T); BENCH_ESCAPE(r); }); \
+        BENCH("sum", tn, n, "baseline", bytes, { \
+            T r = 0; \
+            for (size_t i = 0; i < n; ++i) r += src[i]; \
+            BENCH_ESCAPE(r); }); \
+        \
+        BENCH("foldl", tn, n, "flow", bytes, { \
+            double r = iter_foldl(in, T, double, acc, x, 0.0, acc * 0.5 + x); BENCH_ESCAPE(r); }); \
+        BENCH("foldl", tn, n, "baseline", bytes, { \
+            double r = 0.0; \
+            for (size_t i = 0; i < n; ++i) r = r * 0.5 + src[i]; \
+            BENCH_ESCAPE(r); }); \
+        BENCH("foldr", tn, n, "flow", bytes, { \
+            double r = iter_foldr(in, T, double, acc, x, 0.0, acc * 0.5 + x); BENCH_ESCAPE(r); }); \
+        BENCH("foldr", tn, n, "baseline", bytes, { \
+            double r = 0.0; \
+            for (size_t i = n; i-- > 0;) r = r * 0.5 + src[i]; \
+            BENCH_ESCAPE(r); }); \
+        \
+        BENCH("scan", tn, n, "flow", 2 * bytes, { \
+            Iterator r = iter_scan(in, T, x, (T)0, acc + x); BENCH_ESCAPE(r.data); iter_free(r); }); \
+        BENCH("scan", tn, n, "baseline", 2 * bytes, { \
+            T *r = malloc(bytes), acc = 0; \
+            for (size_t i = 0; i < n; ++i) r[i] = acc += src[i]; \
+            BENCH_ESCAPE(r); free(r); }); \
+        \
+        BENCH("zip", tn, n, "flow", 4 * bytes, { \
+            Iterator r = iter_zip(T, in, T, in2, bench_pair_##name); BENCH_ESCAPE(r.data); iter_free(r); }); \
+        BENCH("zip", tn, n, "baseline", 4 * bytes, { \
+            bench_pair_##name *r = malloc(n * sizeof(*r)); \
+            for (size_t i = 0; i < n; ++i) r[i] = (bench_pair_##name){ src[i], src2[i] }; \
+            BENCH_ESCAPE(r); free(r); }); \
+        \
+        BENCH("flatten", tn, n, "flow", 2 * bytes, { \
+            Iterator r = iter_flatten(nested, Iterator, T); BENCH_ESCAPE(r.data); iter_free(r); }); \
+        BENCH("flatten", tn, n, "baseline", 2 * bytes, { \
+            T *r = malloc(bytes); \
+            size_t k = 0; \
+            for (size_t c = 0; c < nchunks; ++c) { \
+                memcpy(r + k, chunks[c].data, chunks[c].len * sizeof(T)); \
+                k += chunks[c].len; \
+            } \
+            BENCH_ESCAPE(r); free(r); }); \
+        \
+        BENCH("unique", tn, n, "flow", bytes, { \
+            Iterator r = iter_unique(in_small); BENCH_ESCAPE(r.data); iter_free(r); }); \
+        BENCH("unique", tn, n, "baseline", bytes, { \
+            T *r = malloc(bytes); \
+            size_t k = 0; \
+            for (size_t i = 0; i < n; ++i) { \
+                size_t j = 0; \
+                while (j < k && memcmp(&r[j], &small[i], sizeof(T))) ++j; \
+                if (j == k) r[k++] = small[i]; \
+            } \
+            BENCH_ESCAPE(r); free(r); }); \
+        \
+        BENCH("reverse", tn, n, "flow", 2 * bytes, { \
+            Iterator r = iter_reverse(in); BENCH_ESCAPE(r.data); iter_free(r); }); \
+        BENCH("reverse", tn, n, "baseline", 2 * bytes, { \
+            T *r = malloc(bytes); \
+            for (size_t i = 0; i < n; ++i) r[i] = src[n - 1 - i]; \
+            BENCH_ESCAPE(r); free(r); }); \
+        \
+        BENCH("concat", tn, 2 * n, "flow", 4 * bytes, { \
+            Iterator r = iter_concat(in, in2); BENCH_ESCAPE(r.data); iter_free(r); }); \
+        BENCH("concat", tn, 2 * n, "baseline", 4 * bytes, { \
+            T *r = malloc(2 * bytes); \
+            memcpy(r, src, bytes); \
+            memcpy(r + n, src2, bytes); \
+            BENCH_ESCAPE(r); free(r); }); \
+        \
+        Iterator half = { .data = src, .len = n / 2, .elem_size = sizeof(T), .align = FLOW_ALIGN }; \
+        BENCH("repeat", tn, n, "flow", bytes / 2 + bytes, { \
+            Iterator r = iter_repeat(half, 2); BENCH_ESCAPE(r.data); iter_free(r); }); \
+        BENCH("repeat", tn, n, "baseline", bytes / 2 + bytes, { \
+            T *r = malloc(bytes); \
+            memcpy(r, src, n / 2 * sizeof(T)); \
+            memcpy(r + n / 2, src, n / 2 * sizeof(T)); \
+            BENCH_ESCAPE(r); free(r); }); \
+        \
+        BENCH("pad", tn, n, "flow", bytes / 2 + bytes, { \
+            Iterator r = iter_pad(half, n, (T)7); BENCH_ESCAPE(r.data); iter_free(r); }); \
+        BENCH("pad", tn, n, "baseline", bytes / 2 + bytes, { \
+            T *r = malloc(bytes); \
+            memcpy(r, src, n / 2 * sizeof(T)); \
+            for (size_t i = n / 2; i < n; ++i) r[i] = (T)7; \
+            BENCH_ESCAPE(r); free(r); }); \
+        \
+        BENCH("range", tn, n, "flow", bytes, { \
+            Iterator r = iter_range(T, (T)0, (T)n); BENCH_ESCAPE(r.data); iter_free(r); }); \
+        BENCH("range", tn, n, "baseline", bytes, { \
+            T *r = malloc(bytes); \
+            for (size_t i = 0; i < n; ++i) r[i] = (T)i; \
+            BENCH_ESCAPE(r); free(r); }); \
+        \
+        free(chunks); \
+        flow_free(src); \
+        flow_free(src2); \
+        flow_free(small); \
+    }
+
+BENCH_DEFINE_TYPE(uint32_t, u32)
+BENCH_DEFINE_TYPE(uint64_t, u64)
+BENCH_DEFINE_TYPE(float, f32)
+BENCH_DEFINE_TYPE(double, f64)
+
+int main(int argc, char *argv[]) {
+    bench_parse_args(argc, argv);
+    bench_header();
+    for (size_t n = bench_min_n; n <= bench_max_n; n *= 10) {
+        bench_u32(n);
+        bench_u64(n);
+        bench_f32(n);
+        bench_f64(n);
+    }
+    return bench_finish();
+}
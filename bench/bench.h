@@ -0,0 +1,390 @@
+#ifndef FLOW_BENCH_H
+#define FLOW_BENCH_H
+
+// Minimal timing harness shared by the flow.h benchmarks.
+//
+// Every measurement is one CSV row on stdout:
+//   op,type,n,impl,ns_per_elem,gb_per_s
+// where impl is "flow" (the flow.h operator) or "baseline" (a hand-written loop doing the same
+// work), ns_per_elem is the best-of-reps time divided by n, and gb_per_s counts the bytes the
+// operation must read plus write.
+//
+// With --counters, hardware counters (perf_event_open, Linux) are read around each run and the
+// row gains cycles_per_elem,ipc,l1d_miss_per_elem,llc_miss_per_elem,branch_miss_per_elem,
+// dtlb_miss_per_elem, taken from the fastest run. Counters the kernel or container refuses are
+// left empty; if none can be opened the columns stay empty and a note goes to stderr.
+//
+// With --save FILE, every measurement also goes to a JSON baseline keyed by op, type, n, impl
+// and CPU model, holding the median time per run and a 95% confidence interval of the median.
+// With --compare FILE, each measurement is checked against the matching baseline entry; a
+// regression is reported on stderr when the current interval lies entirely above the baseline
+// one and the median is slower by more than --threshold percent, and bench_finish() then
+// returns 1. Both modes repeat each measurement at least BENCH_STAT_REPS times.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <math.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "../flow.h"
+
+// Run-time options (see bench_parse_args).
+static size_t bench_min_n = 1000;
+static size_t bench_max_n = 10000000;
+static unsigned bench_min_reps = 5;
+static unsigned bench_max_reps = 1000;
+static double bench_min_ns = 10e6; // keep repeating small sizes until this much time has passed
+static const char *bench_ops = NULL;   // comma-separated op filter (NULL = all)
+static const char *bench_types = NULL; // comma-separated type filter (NULL = all)
+static int bench_counters = 0;         // read hardware counters (--counters)
+static const char *bench_save = NULL;    // baseline file to write (--save)
+static const char *bench_compare = NULL; // baseline file to compare against (--compare)
+static double bench_threshold = 5.0;     // regression threshold in percent (--threshold)
+static unsigned bench_threads = 0;       // largest thread count for scaling runs (--threads, 0 = all CPUs)
+
+// Keeps a value or the memory behind a pointer observable, so the optimiser cannot drop the work.
+#define BENCH_ESCAPE(p) __asm__ volatile("" : : "g"(p) : "memory")
+
+static inline double bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Internal: 1 if name is one of the comma-separated entries of list (or list is NULL).
+static inline int _bench_listed(const char *list, const char *name) {
+    if (!list) return 1;
+    size_t len = strlen(name);
+    for (const char *p = list; *p;) {
+        const char *comma = strchr(p, ',');
+        size_t n = comma ? (size_t)(comma - p) : strlen(p);
+        if (n == len && strncmp(p, name, n) == 0) return 1;
+        if (!comma) break;
+        p = comma + 1;
+    }
+    return 0;
+}
+
+// Hardware counters read with --counters, in output order.
+enum { BENCH_CYCLES, BENCH_INSTRUCTIONS, BENCH_L1D_MISSES, BENCH_LLC_MISSES, BENCH_BRANCH_MISSES, BENCH_DTLB_MISSES, BENCH_NCOUNTERS };
+
+// One run's counter values; a counter is valid only if its bit is set in mask.
+typedef struct {
+    uint64_t value[BENCH_NCOUNTERS];
+    unsigned mask;
+} BenchCounters;
+
+static int bench_counter_fd[BENCH_NCOUNTERS] = { -1, -1, -1, -1, -1, -1 };
+
+// Internal: open the counters that are available; each one is independent, so a refused counter
+// (no PMU in a VM, perf_event_paranoid, seccomp) only blanks its own column.
+static inline void _bench_counters_open(void) {
+#if defined(__linux__)
+    static const struct { uint32_t type; uint64_t config; } events[BENCH_NCOUNTERS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    };
+    int opened = 0;
+    for (int i = 0; i < BENCH_NCOUNTERS; ++i) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        bench_counter_fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        opened += bench_counter_fd[i] >= 0;
+    }
+    if (!opened) fprintf(stderr, "bench: hardware counters unavailable (perf_event_open failed); counter columns left empty\n");
+#else
+    fprintf(stderr, "bench: hardware counters need Linux perf_event_open; counter columns left empty\n");
+#endif
+}
+
+static inline void bench_counters_start(void) {
+#if defined(__linux__)
+    for (int i = 0; i < BENCH_NCOUNTERS; ++i)
+        if (bench_counter_fd[i] >= 0) {
+            ioctl(bench_counter_fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(bench_counter_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+}
+
+static inline BenchCounters bench_counters_stop(void) {
+    BenchCounters c = { { 0 }, 0 };
+#if defined(__linux__)
+    for (int i = 0; i < BENCH_NCOUNTERS; ++i)
+        if (bench_counter_fd[i] >= 0) ioctl(bench_counter_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (int i = 0; i < BENCH_NCOUNTERS; ++i) {
+        uint64_t r[3]; // value, time enabled, time running
+        if (bench_counter_fd[i] < 0 || read(bench_counter_fd[i], r, sizeof(r)) != (ssize_t)sizeof(r) || !r[2]) continue;
+        // Scale up if the kernel multiplexed this counter with others.
+        c.value[i] = r[2] < r[1] ? (uint64_t)((double)r[0] * r[1] / r[2]) : r[0];
+        c.mask |= 1u << i;
+    }
+#endif
+    return c;
+}
+
+/** @brief Print the CSV header matching the rows bench_report() prints. */
+static inline void bench_header(void) {
+    printf("op,type,n,impl,ns_per_elem,gb_per_s%s\n",
+           bench_counters ? ",cycles_per_elem,ipc,l1d_miss_per_elem,llc_miss_per_elem,branch_miss_per_elem,dtlb_miss_per_elem" : "");
+}
+
+static inline void bench_report(const char *op, const char *type, size_t n, const char *impl, size_t bytes, double best_ns,
+                                const BenchCounters *c) {
+    printf("%s,%s,%zu,%s,%.4f,%.3f", op, type, n, impl, best_ns / (double)n, (double)bytes / best_ns);
+    if (bench_counters) {
+        for (int i = 0; i < BENCH_NCOUNTERS; ++i) {
+            putchar(',');
+            if (i == BENCH_INSTRUCTIONS) { // reported as IPC
+                if ((c->mask & 3u) == 3u && c->value[BENCH_CYCLES]) printf("%.3f", (double)c->value[i] / c->value[BENCH_CYCLES]);
+            } else if (c->mask & (1u << i)) {
+                printf("%.4f", (double)c->value[i] / (double)n);
+            }
+        }
+    }
+    putchar('\n');
+    fflush(stdout);
+}
+
+// Samples kept per measurement for the median (later runs only count towards the best time).
+#define BENCH_MAX_SAMPLES 1000
+// Minimum repetitions per measurement with --save or --compare.
+#define BENCH_STAT_REPS 30
+
+// One baseline entry: median nanoseconds per run and its 95% confidence interval.
+typedef struct {
+    char op[32], type[16], impl[16], cpu[128];
+    size_t n;
+    double median, lo, hi;
+    unsigned samples;
+} BenchStat;
+
+static double bench_samples[BENCH_MAX_SAMPLES] __attribute__((unused)); // filled by BENCH
+static char bench_cpu[128] = "unknown";
+static FILE *bench_save_file = NULL;
+static BenchStat *bench_baseline = NULL;
+static size_t bench_baseline_len = 0;
+static unsigned bench_saved = 0, bench_compared = 0, bench_regressions = 0, bench_improvements = 0;
+
+// Internal: CPU model name, so baselines from different machines are never compared.
+static inline void _bench_cpu_name(void) {
+#if defined(__linux__)
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    char line[256];
+    while (f && fgets(line, sizeof(line), f)) {
+        char *colon = strchr(line, ':');
+        if (strncmp(line, "model name", 10) || !colon) continue;
+        colon += 1 + (colon[1] == ' ');
+        colon[strcspn(colon, "\n")] = 0;
+        snprintf(bench_cpu, sizeof(bench_cpu), "%s", colon);
+        break;
+    }
+    if (f) fclose(f);
+#endif
+    for (char *p = bench_cpu; *p; ++p)
+        if (*p == '"' || *p == '\\') *p = ' ';
+}
+
+static inline int _bench_cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Internal: median of the samples and a distribution-free 95% confidence interval for it,
+// from the order statistics at ranks n/2 -+ 1.96 * sqrt(n) / 2.
+static inline void _bench_median(double *samples, unsigned count, BenchStat *st) {
+    qsort(samples, count, sizeof(double), _bench_cmp_double);
+    double half = 0.98 * sqrt((double)count);
+    long lo = (long)floor(count / 2.0 - half), hi = (long)ceil(count / 2.0 + half);
+    if (lo < 0) lo = 0;
+    if (hi > (long)count - 1) hi = (long)count - 1;
+    st->median = count % 2 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    st->lo = samples[lo];
+    st->hi = samples[hi];
+    st->samples = count;
+}
+
+// Internal: copy the string value of "key" in a one-line JSON object into buf.
+static inline int _bench_json_str(const char *line, const char *key, char *buf, size_t size) {
+    char pat[40];
+    snprintf(pat, sizeof(pat), "\"%s\":\"", key);
+    const char *p = strstr(line, pat), *end;
+    if (!p || !(end = strchr(p += strlen(pat), '"'))) return 0;
+    snprintf(buf, size, "%.*s", (int)(end - p), p);
+    return 1;
+}
+
+// Internal: the numeric value of "key" in a one-line JSON object (NaN if absent).
+static inline double _bench_json_num(const char *line, const char *key) {
+    char pat[40];
+    snprintf(pat, sizeof(pat), "\"%s\":", key);
+    const char *p = strstr(line, pat);
+    return p ? strtod(p + strlen(pat), NULL) : NAN;
+}
+
+// Internal: read a baseline written by --save (one entry per line).
+static inline void _bench_load_baseline(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) { fprintf(stderr, "bench: cannot open baseline %s\n", path); exit(2); }
+    char line[1024];
+    size_t cap = 0;
+    while (fgets(line, sizeof(line), f)) {
+        BenchStat st;
+        memset(&st, 0, sizeof(st));
+        if (!_bench_json_str(line, "op", st.op, sizeof(st.op)) || !_bench_json_str(line, "type", st.type, sizeof(st.type)) ||
+            !_bench_json_str(line, "impl", st.impl, sizeof(st.impl)) || !_bench_json_str(line, "cpu", st.cpu, sizeof(st.cpu)))
+            continue;
+        st.n = (size_t)_bench_json_num(line, "n");
+        st.median = _bench_json_num(line, "median_ns");
+        st.lo = _bench_json_num(line, "lo_ns");
+        st.hi = _bench_json_num(line, "hi_ns");
+        st.samples = (unsigned)_bench_json_num(line, "samples");
+        if (bench_baseline_len == cap) {
+            cap = cap ? 2 * cap : 64;
+            bench_baseline = (BenchStat *)realloc(bench_baseline, cap * sizeof(BenchStat));
+        }
+        bench_baseline[bench_baseline_len++] = st;
+    }
+    fclose(f);
+}
+
+// Internal: save and/or compare one measurement.
+static inline void _bench_track(const char *op, const char *type, size_t n, const char *impl, double *samples, unsigned count) {
+    BenchStat cur;
+    memset(&cur, 0, sizeof(cur));
+    _bench_median(samples, count, &cur);
+    if (bench_save_file)
+        fprintf(bench_save_file, "%s\n{\"op\":\"%s\",\"type\":\"%s\",\"n\":%zu,\"impl\":\"%s\",\"cpu\":\"%s\","
+                "\"median_ns\":%.1f,\"lo_ns\":%.1f,\"hi_ns\":%.1f,\"samples\":%u}",
+                bench_saved++ ? "," : "", op, type, n, impl, bench_cpu, cur.median, cur.lo, cur.hi, cur.samples);
+    for (size_t i = 0; i < bench_baseline_len; ++i) {
+        const BenchStat *b = &bench_baseline[i];
+        if (b->n != n || strcmp(b->op, op) || strcmp(b->type, type) || strcmp(b->impl, impl) || strcmp(b->cpu, bench_cpu)) continue;
+        double change = 100.0 * (cur.median / b->median - 1.0);
+        ++bench_compared;
+        if (cur.lo > b->hi && change > bench_threshold) {
+            ++bench_regressions;
+            fprintf(stderr, "REGRESSION %s %s n=%zu %s: %.4f -> %.4f ns/elem (%+.1f%%)\n", op, type, n, impl,
+                    b->median / n, cur.median / n, change);
+        } else if (cur.hi < b->lo && -change > bench_threshold) {
+            ++bench_improvements;
+            fprintf(stderr, "improved   %s %s n=%zu %s: %.4f -> %.4f ns/elem (%+.1f%%)\n", op, type, n, impl,
+                    b->median / n, cur.median / n, change);
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Finish the run: close the --save baseline and summarise the --compare results.
+ * @return 1 if a significant regression was found, 0 otherwise (suitable as the exit code).
+ */
+static inline int bench_finish(void) {
+    if (bench_save_file) {
+        fputs("\n]}\n", bench_save_file);
+        fclose(bench_save_file);
+        bench_save_file = NULL;
+    }
+    if (bench_compare) {
+        if (!bench_compared) fprintf(stderr, "bench: no measurement matched the baseline (cpu \"%s\")\n", bench_cpu);
+        else fprintf(stderr, "bench: %u compared, %u regressions, %u improvements (threshold %.1f%%)\n",
+                     bench_compared, bench_regressions, bench_improvements, bench_threshold);
+    }
+    free(bench_baseline);
+    bench_baseline = NULL;
+    return bench_regressions ? 1 : 0;
+}
+
+/**
+ * @brief Time a statement and report its best-of-reps time as one CSV row.
+ * @param op Operator name (matched against --ops).
+ * @param type Element type name (matched against --types).
+ * @param n Number of elements processed.
+ * @param impl "flow" or "baseline".
+ * @param bytes Bytes read plus written by one run.
+ * @param ... The statement(s) to time; they must release anything they allocate.
+ */
+#define BENCH(op, type, n, impl, bytes, ...) \
+    do { \
+        if (_bench_listed(bench_ops, op) && _bench_listed(bench_types, type)) { \
+            double _best = 1e300, _total = 0; \
+            unsigned _reps = 0; \
+            BenchCounters _best_c = { { 0 }, 0 }; \
+            do { \
+                if (bench_counters) bench_counters_start(); \
+                double _t0 = bench_now_ns(); \
+                __VA_ARGS__; \
+                double _dt = bench_now_ns() - _t0; \
+                BenchCounters _c = bench_counters ? bench_counters_stop() : _best_c; \
+                if (_dt < _best) _best = _dt, _best_c = _c; \
+                if (_reps < BENCH_MAX_SAMPLES) bench_samples[_reps] = _dt; \
+                _total += _dt; \
+                ++_reps; \
+            } while (_reps < bench_min_reps || (_total < bench_min_ns && _reps < bench_max_reps)); \
+            bench_report(op, type, n, impl, bytes, _best, &_best_c); \
+            if (bench_save || bench_compare) \
+                _bench_track(op, type, n, impl, bench_samples, _reps < BENCH_MAX_SAMPLES ? _reps : BENCH_MAX_SAMPLES); \
+        } \
+    } while (0)
+
+/**
+ * @brief Parse the common command line options.
+ *   --min N      smallest size (default 1e3)      --max N      largest size (default 1e7; up to 1e9)
+ *   --reps N     minimum repetitions (default 5)  --ops a,b    only these operators
+ *   --types a,b  only these element types       --counters   add hardware counter columns
+ *   --save F     write a JSON baseline to F     --compare F  report regressions against baseline F
+ *   --threshold P  smallest slowdown in percent reported as a regression (default 5)
+ *   --threads N  largest thread count for the scaling benchmark (default: online CPUs)
+ * Sizes accept scientific notation (1e9). Call bench_finish() at the end and return its result.
+ */
+static inline void bench_parse_args(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i], *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(arg, "--counters")) {
+            bench_counters = 1;
+            _bench_counters_open();
+            continue;
+        }
+        if (!val) { fprintf(stderr, "missing value for %s\n", arg); exit(2); }
+        if (!strcmp(arg, "--min")) bench_min_n = (size_t)strtod(val, NULL);
+        else if (!strcmp(arg, "--max")) bench_max_n = (size_t)strtod(val, NULL);
+        else if (!strcmp(arg, "--reps")) bench_min_reps = (unsigned)atoi(val);
+        else if (!strcmp(arg, "--ops")) bench_ops = val;
+        else if (!strcmp(arg, "--types")) bench_types = val;
+        else if (!strcmp(arg, "--save")) bench_save = val;
+        else if (!strcmp(arg, "--compare")) bench_compare = val;
+        else if (!strcmp(arg, "--threshold")) bench_threshold = strtod(val, NULL);
+        else if (!strcmp(arg, "--threads")) bench_threads = (unsigned)atoi(val);
+        else { fprintf(stderr, "unknown option %s\n", arg); exit(2); }
+        ++i;
+    }
+    if (!bench_save && !bench_compare) return;
+    if (bench_min_reps < BENCH_STAT_REPS) bench_min_reps = BENCH_STAT_REPS;
+    _bench_cpu_name();
+    if (bench_compare) _bench_load_baseline(bench_compare);
+    if (bench_save) {
+        if (!(bench_save_file = fopen(bench_save, "w"))) { fprintf(stderr, "bench: cannot write %s\n", bench_save); exit(2); }
+        fprintf(bench_save_file, "{\"cpu\":\"%s\",\"results\":[", bench_cpu);
+    }
+}
+
+#endif // FLOW_BENCH_H
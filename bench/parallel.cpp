@@ -0,0 +1,92 @@
+// Compares flow.h macros, flow.hpp expression templates and the C++17 standard algorithms
+// (sequential, and parallel via the TBB backend) running directly over an Iterator.
+//
+// Build and run from the repository root:
+//   gcc -O3 -march=native -c bench/parallel_native.c -o /tmp/parallel_native.o
+//   g++ -std=c++17 -O3 -march=native bench/parallel.cpp /tmp/parallel_native.o -ltbb -o /tmp/parallel
+//   /tmp/parallel [n] [reps]
+//
+// Output: one CSV row per (op, impl): op,impl,n,ns_per_elem,gb_per_s
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <execution>
+#include <functional>
+#include <numeric>
+
+#include "../flow.hpp"
+
+extern "C" {
+double native_map_sum(Iterator it);
+double native_foldl(Iterator it);
+Iterator native_map(Iterator it);
+size_t native_filter_count(Iterator it);
+}
+
+static volatile double sink;
+
+// Best-of-reps wall time of f(), reported per element and as input bandwidth.
+template <class F>
+static void run(const char *op, const char *impl, size_t n, int reps, F &&f) {
+    double best = 1e300;
+    for (int r = 0; r < reps; ++r) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+        if (ns < best) best = ns;
+    }
+    printf("%s,%s,%zu,%.3f,%.2f\n", op, impl, n, best / n, n * sizeof(double) / best);
+}
+
+int main(int argc, char *argv[]) {
+    size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : (size_t)1 << 24;
+    int reps = argc > 2 ? atoi(argv[2]) : 5;
+
+    flow::view<double> in = flow::alloc<double>(n);
+    for (size_t i = 0; i < n; ++i) in[i] = (double)(i % 1000) / 1000.0;
+    Iterator it = in;
+    auto sq1 = [](double x) { return x * x + 1.0; };
+
+    printf("op,impl,n,ns_per_elem,gb_per_s\n");
+
+    run("map_sum", "flow_h", n, reps, [&] { sink = native_map_sum(it); });
+    run("map_sum", "flow_h_foldl", n, reps, [&] { sink = native_foldl(it); });
+    run("map_sum", "flow_hpp", n, reps, [&] { sink = flow::view<double>(it) | flow::map(sq1) | flow::sum(); });
+    run("map_sum", "std_seq", n, reps, [&] {
+        sink = std::transform_reduce(std::execution::seq, in.begin(), in.end(), 0.0, std::plus<>(), sq1);
+    });
+    run("map_sum", "std_par_unseq", n, reps, [&] {
+        sink = std::transform_reduce(std::execution::par_unseq, in.begin(), in.end(), 0.0, std::plus<>(), sq1);
+    });
+
+    auto lin = [](double x) { return x * 2.0 + 1.0; };
+    run("map", "flow_h", n, reps, [&] {
+        Iterator out = native_map(it);
+        sink = ((double *)out.data)[n - 1];
+        flow_free(out.data);
+    });
+    run("map", "flow_hpp", n, reps, [&] {
+        Iterator out = flow::view<double>(it) | flow::map(lin) | flow::collect();
+        sink = ((double *)out.data)[n - 1];
+        flow_free(out.data);
+    });
+    run("map", "std_par_unseq", n, reps, [&] {
+        flow::view<double> out = flow::alloc<double>(n);
+        std::transform(std::execution::par_unseq, in.begin(), in.end(), out.begin(), lin);
+        sink = out[n - 1];
+        flow_free(out.data);
+    });
+
+    auto half = [](double x) { return x < 0.5; };
+    run("filter_count", "flow_h", n, reps, [&] { sink = (double)native_filter_count(it); });
+    run("filter_count", "flow_hpp", n, reps, [&] { sink = (double)(flow::view<double>(it) | flow::filter(half) | flow::count()); });
+    run("filter_count", "std_par_unseq", n, reps, [&] {
+        sink = (double)std::count_if(std::execution::par_unseq, in.begin(), in.end(), half);
+    });
+
+    flow_free(in.data);
+    return 0;
+}
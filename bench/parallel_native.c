@@ -0,0 +1,25 @@
+// Native flow.h side of bench/parallel.cpp: the same kernels written with the C macros,
+// compiled as C because the statement-expression macros are C-only.
+#include "../flow.h"
+
+double native_map_sum(Iterator it) {
+    Iterator sq = iter_map(it, double, x, double, x * x + 1.0);
+    double s = iter_sum(sq, double);
+    iter_free(sq);
+    return s;
+}
+
+double native_foldl(Iterator it) {
+    return iter_foldl(it, double, double, acc, x, 0.0, acc + (x * x + 1.0));
+}
+
+Iterator native_map(Iterator it) {
+    return iter_map(it, double, x, double, x * 2.0 + 1.0);
+}
+
+size_t native_filter_count(Iterator it) {
+    Iterator kept = iter_filter(it, double, x, x < 0.5);
+    size_t n = kept.len;
+    iter_free(kept);
+    return n;
+}
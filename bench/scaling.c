@@ -0,0 +1,176 @@
+// Strong- and weak-scaling benchmark: runs flow.h operators over per-thread slices at 1..N
+// threads and compares their bandwidth with a STREAM triad run on the same threads.
+//
+// Each thread applies the operator to its contiguous slice (as a parallel operator built on
+// flow.h would), so outputs are allocated and first touched by the thread that writes them.
+// Strong scaling keeps n fixed (--max); weak scaling gives every thread --max / N elements.
+//
+// Output is CSV:
+//   mode,op,threads,n,ns,speedup,efficiency,gb_per_s,stream_gb_per_s,bw_fraction,bound
+// speedup is t(1) / t(T) for strong and T * t(1) / t(T) for weak scaling; efficiency is
+// speedup / T. bw_fraction is gb_per_s over the triad bandwidth at the same thread count, and
+// bound is "memory" once it reaches BENCH_BW_BOUND: more threads will not help that operator.
+//
+// Build and run from the repository root:
+//   gcc -O3 -march=native -pthread -o /tmp/flow_scaling bench/scaling.c -lm
+//   /tmp/flow_scaling [--max 1e8] [--threads 16] [--ops map,sum] > scaling.csv
+// Build with -DFLOW_TRACE to also record one span per slice (see flow_trace_write).
+
+#include <pthread.h>
+
+#include "bench.h"
+
+// Fraction of STREAM triad bandwidth from which an operator is reported as memory-bound.
+#define BENCH_BW_BOUND 0.8
+#define BENCH_MAX_THREADS 256
+
+typedef enum { OP_TRIAD, OP_MAP, OP_FILTER, OP_SUM, OP_FOLD } ScalingOp;
+
+static const struct { const char *name; double bytes_per_elem; } scaling_ops[] = {
+    [OP_TRIAD] = { "triad", 3 * sizeof(double) },
+    [OP_MAP] = { "map", 2 * sizeof(double) },
+    [OP_FILTER] = { "filter_50", 1.5 * sizeof(double) },
+    [OP_SUM] = { "sum", sizeof(double) },
+    [OP_FOLD] = { "reduce_assoc", sizeof(double) },
+};
+
+// Persistent workers released by a barrier for every run of the current job.
+static struct {
+    pthread_t tid[BENCH_MAX_THREADS];
+    pthread_barrier_t start, done;
+    unsigned nthreads;
+    int quit;
+    ScalingOp op;
+    size_t n;
+    double *a, *b, *c; // triad: a = b + 3 * c; operators read b
+    double partial[BENCH_MAX_THREADS][8]; // one cache line per thread
+} pool;
+
+static void run_slice(unsigned t) {
+    size_t lo = pool.n * t / pool.nthreads, hi = pool.n * (t + 1) / pool.nthreads;
+    Iterator in = { .data = pool.b + lo, .len = hi - lo, .elem_size = sizeof(double), .align = 0 };
+    uint64_t t0 = flow_trace_begin();
+    double r = 0;
+    switch (pool.op) {
+    case OP_TRIAD:
+        for (size_t i = lo; i < hi; ++i) pool.a[i] = pool.b[i] + 3.0 * pool.c[i];
+        break;
+    case OP_MAP: {
+        Iterator out = iter_map(in, double, x, double, x * 2.0 + 1.0);
+        BENCH_ESCAPE(out.data);
+        iter_free(out);
+        break;
+    }
+    case OP_FILTER: {
+        Iterator out = iter_filter(in, double, x, x < 0.5);
+        r = (double)out.len;
+        iter_free(out);
+        break;
+    }
+    case OP_SUM:
+        r = iter_sum(in, double);
+        break;
+    case OP_FOLD:
+        r = iter_reduce_assoc(in, double, double, acc, x, 0.0, acc + x * x, acc + x);
+        break;
+    }
+    pool.partial[t][0] = r;
+    flow_trace_end(scaling_ops[pool.op].name, t0, lo, hi, (size_t)((hi - lo) * scaling_ops[pool.op].bytes_per_elem));
+}
+
+static void *worker(void *arg) {
+    unsigned t = (unsigned)(uintptr_t)arg;
+    for (;;) {
+        pthread_barrier_wait(&pool.start);
+        if (pool.quit) return NULL;
+        run_slice(t);
+        pthread_barrier_wait(&pool.done);
+    }
+}
+
+// Start nthreads - 1 workers; the calling thread runs slice 0.
+static void pool_start(unsigned nthreads) {
+    pool.nthreads = nthreads;
+    pool.quit = 0;
+    pthread_barrier_init(&pool.start, NULL, nthreads);
+    pthread_barrier_init(&pool.done, NULL, nthreads);
+    for (unsigned t = 1; t < nthreads; ++t) pthread_create(&pool.tid[t], NULL, worker, (void *)(uintptr_t)t);
+}
+
+static void pool_stop(void) {
+    pool.quit = 1;
+    pthread_barrier_wait(&pool.start);
+    for (unsigned t = 1; t < pool.nthreads; ++t) pthread_join(pool.tid[t], NULL);
+    pthread_barrier_destroy(&pool.start);
+    pthread_barrier_destroy(&pool.done);
+}
+
+// Best-of-reps time of one op over n elements on the running pool.
+static double pool_time(ScalingOp op, size_t n) {
+    pool.op = op;
+    pool.n = n;
+    double best = 1e300, total = 0;
+    unsigned reps = 0;
+    do {
+        double t0 = bench_now_ns();
+        pthread_barrier_wait(&pool.start);
+        run_slice(0);
+        pthread_barrier_wait(&pool.done);
+        double dt = bench_now_ns() - t0;
+        for (unsigned t = 0; t < pool.nthreads; ++t) BENCH_ESCAPE(pool.partial[t][0]);
+        if (dt < best) best = dt;
+        total += dt;
+        ++reps;
+    } while (reps < bench_min_reps || (total < bench_min_ns && reps < bench_max_reps));
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    bench_max_n = 10000000;
+    bench_parse_args(argc, argv);
+    unsigned max_threads = bench_threads;
+    if (!max_threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        max_threads = cpus > 0 ? (unsigned)cpus : 1;
+    }
+    if (max_threads > BENCH_MAX_THREADS) max_threads = BENCH_MAX_THREADS;
+
+    size_t n_max = bench_max_n;
+    pool.a = _flow_alloc(FLOW_OP_OTHER, n_max * sizeof(double));
+    pool.b = _flow_alloc(FLOW_OP_OTHER, n_max * sizeof(double));
+    pool.c = _flow_alloc(FLOW_OP_OTHER, n_max * sizeof(double));
+    for (size_t i = 0; i < n_max; ++i) {
+        pool.a[i] = 0;
+        pool.b[i] = (double)(i % 1000) / 1000.0;
+        pool.c[i] = 1.0;
+    }
+
+    static const char *const modes[] = { "strong", "weak" };
+    double t1[2][sizeof(scaling_ops) / sizeof(*scaling_ops)];
+    printf("mode,op,threads,n,ns,speedup,efficiency,gb_per_s,stream_gb_per_s,bw_fraction,bound\n");
+    for (unsigned threads = 1;; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+        pool_start(threads);
+        for (int mode = 0; mode < 2; ++mode) {
+            size_t n = mode == 0 ? n_max : n_max / max_threads * threads;
+            double stream_gbs = 0;
+            for (ScalingOp op = OP_TRIAD; op <= OP_FOLD; ++op) {
+                if (op != OP_TRIAD && !_bench_listed(bench_ops, scaling_ops[op].name)) continue;
+                double ns = pool_time(op, n);
+                if (threads == 1) t1[mode][op] = ns;
+                double speedup = (mode == 0 ? 1.0 : threads) * t1[mode][op] / ns;
+                double gbs = n * scaling_ops[op].bytes_per_elem / ns;
+                if (op == OP_TRIAD) stream_gbs = gbs;
+                double frac = gbs / stream_gbs;
+                printf("%s,%s,%u,%zu,%.0f,%.3f,%.3f,%.3f,%.3f,%.3f,%s\n", modes[mode], scaling_ops[op].name, threads, n, ns,
+                       speedup, speedup / threads, gbs, stream_gbs, frac, frac >= BENCH_BW_BOUND ? "memory" : "compute");
+                fflush(stdout);
+            }
+        }
+        pool_stop();
+        if (threads == max_threads) break;
+    }
+    flow_free(pool.a);
+    flow_free(pool.b);
+    flow_free(pool.c);
+    return bench_finish();
+}
@@ -24,10 +24,15 @@ char* double_to_str(double d) {
 size_t str_len(char* s) { return strlen(s); }
 int size_t_to_int(size_t n) { return (int)(n * 10); }
 
+// Typed iterators: Iterator_double (predefined) plus restrict-qualified kernels (iter_double_sum, ...)
+double square(double x) { return x * x; }
+
 // Example: Clang blocks-based currying for arity 5
 float add5(float a, float b, float c, float d, float e) {
     return a + b + c + d + e;
 }
+// Allocation-free currying (GCC and Clang): add5_c(a)(...) returns closure structs
+FLOW_DEFINE_CURRY(add5_c, float, add5, float, float, float, float, float)
 
 int main(int argc, char *argv[]) {
 
@@ -133,6 +138,10 @@ int main(int argc, char *argv[]) {
     int sum_l = iter_foldl(it3, int, int, acc, x, 0, acc + x);
     printf("foldl sum: %d\n---\n", sum_l);
 
+    // reduce_assoc: like foldl, but with independent accumulators for associative ops
+    int prod = iter_reduce_assoc(it3, int, int, acc, x, 1, acc * (x / 10), acc * x);
+    printf("reduce_assoc product: %d\n---\n", prod);
+
     // foldr: subtract right-to-left
     int sub_r = iter_foldr(it3, int, int, acc, x, 0, x - acc);
     printf("foldr subtract: %d\n---\n", sub_r);
@@ -172,6 +181,15 @@ int main(int argc, char *argv[]) {
     iter_for(flat, int, x, printf("%d ", x));
     printf("\n---\n");
 
+    // Nested (CSR) iterators: one values buffer + offsets, so flatten is free
+    NestedIterator nested = iter_nest(iters_iter, Iterator, int);
+    printf("nested flatten: ");
+    iter_for(iter_nested_flatten(nested), int, x, printf("%d ", x));
+    printf("| per-list sums: ");
+    iter_for(iter_nested_sum(nested, int), int, x, printf("%d ", x));
+    printf("\n---\n");
+    iter_nested_free(nested);
+
     // iter_partition: even/odd split
     IteratorPartitionResult part = iter_partition(it3, int, x, x % 3 == 0);
     printf("partition (x mod 3 == 0): ");
@@ -200,6 +218,143 @@ int main(int argc, char *argv[]) {
     iter_for(rng, int, x, printf("%d ", x));
     printf("\n---\n");
 
+    // Roaring bitmaps: compressed integer sets with fast set algebra
+    printf("\n=====\nRoaring Bitmaps:\n---\n");
+    unsigned ids_a[] = {1, 5, 9, 70000, 70001, 70002};
+    unsigned ids_b[] = {5, 9, 12, 70001};
+    FlowRoaring ra = iter_to_roaring(to_iter(ids_a));
+    FlowRoaring rb = iter_to_roaring(to_iter(ids_b));
+    FlowRoaring both = roaring_and(ra, rb);
+    printf("and: ");
+    iter_for(iter_from_roaring(both), uint32_t, x, printf("%u ", x));
+    printf("| or cardinality: %zu\n---\n", roaring_cardinality(roaring_or(ra, rb)));
+
+    // Dictionary encoding: string comparisons become integer comparisons
+    printf("\n=====\nDictionary Encoding:\n---\n");
+    char* countries[] = {"US", "DE", "US", "FR", "DE", "US"};
+    double spend[] = {10, 20, 30, 40, 50, 60};
+    FlowDictEncoded enc = iter_dict_encode(to_iter(countries));
+    Iterator totals = iter_dict_group_fold(enc.codes, enc.dict, to_iter(spend), double, double, acc, x, 0.0, acc + x);
+    for (uint32_t code = 0; code < enc.dict.len; ++code)
+        printf("%s: %.0f  ", dict_string(enc.dict, code), ((double*)totals.data)[code]);
+    Iterator eu = iter_dict_filter(enc.codes, enc.dict, s, strcmp(s, "US") != 0);
+    printf("\nnon-US rows: ");
+    iter_for(iter_dict_decode(eu, enc.dict), char*, s, printf("%s ", s));
+    printf("\n---\n");
+
+    // String iterators: one arena for all strings instead of a malloc (or static buffer) per string
+    printf("\n=====\nString Iterators:\n---\n");
+    double prices[] = {1.5, 22.25, 3.0, 14.75};
+    StrIterator labels = iter_format(to_iter(prices), double, x, "$%.2f", x);
+    StrIterator copied = iter_map_str(to_iter(prices), double, x, double_to_str(x));
+    StrIterator wide = str_iter_filter(labels, s, strlen(s) > 5);
+    str_iter_for(copied, s, printf("%s ", s));
+    printf("| ");
+    str_iter_for(wide, s, printf("%s ", s));
+    printf("\n---\n");
+    str_iter_free_offsets(wide);
+    str_iter_free(labels);
+    str_iter_free(copied);
+
+    // Typed iterators: convert to/from Iterator without copying, kernels auto-vectorise
+    printf("\n=====\nTyped Iterators:\n---\n");
+    Iterator_double typed = iter_double_from(to_iter(prices));
+    Iterator_double squares = iter_double_map(typed, square);
+    printf("sum: %.2f  dot: %.2f  max square: %.2f\n",
+           iter_double_sum(typed), iter_double_dot(typed, typed), iter_double_max(squares));
+    iter_free(squares);
+
+    // _Generic inference: typed handles pick the kernel and element type automatically
+    Iterator_int nums = to_iter_typed(arr);
+    Iterator_int big_doubled = pipe(
+        nums,
+        iter_map(_, x, int, x * 2),
+        iter_filter(_, x, x > 6)
+    );
+    printf("typed pipe: ");
+    iter_for(big_doubled, x, printf("%d ", x));
+    printf("| sum: %d  max: %d\n---\n", iter_sum(big_doubled), iter_max(big_doubled));
+
+    // Columnar tables: filter/sort/group-by rewrite a selection vector, not the rows
+    printf("\n=====\nColumnar Tables:\n---\n");
+    int region[] = {2, 1, 2, 3, 1, 2};
+    double amount[] = {9.5, 3.0, 12.0, 7.0, 20.0, 1.0};
+    const char* col_names[] = {"region", "amount"};
+    Iterator columns[] = {to_iter(region), to_iter(amount)};
+    FlowTable sales = to_table(col_names, columns);
+    FlowTable big = table_sort_by(table_filter(sales, row, amount[row] > 2.0), double, "amount");
+    printf("sorted: ");
+    table_for(big, row, printf("(%d, %.1f) ", region[row], amount[row]));
+    FlowGroups by_region = table_group_by(big, "region");
+    Iterator region_totals = table_group_fold(big, by_region, double, "amount", double, acc, x, 0.0, acc + x);
+    printf("\ntotals: ");
+    for (size_t g = 0; g < by_region.keys.len; ++g)
+        printf("region %d = %.1f  ", ((int*)by_region.keys.data)[g], ((double*)region_totals.data)[g]);
+    printf("\n---\n");
+
+    // Non-allocating closures: captured args live inline in the returned struct
+    add5_c_3 add13_c = capply(add5_c(10), 1, 2);
+    printf("Curried add5 (FLOW_DEFINE_CURRY): %f\n", capply(add13_c, 4, 5));
+    int small[] = {1, 2, 3};
+    iter_for(iter_map(to_iter(small), int, x, float, capply(add13_c, x, x)), float, v, printf("%.1f ", v));
+    printf("\n");
+
+    // Allocation statistics: compile with -DFLOW_STATS to attribute bytes to each operator.
+    // Buffers are then released with iter_free()/flow_free(); live bytes reveal leaked intermediates.
+    Iterator tmp_range = iter_range(int, 0, 1000);
+    iter_free(iter_map(tmp_range, int, x, double, x * 0.5));
+    iter_free(tmp_range);
+    flow_stats_print(stdout);
+    printf("---\n");
+
+    // pipe() profiling: compile with -DFLOW_PROFILE to time each step of every pipe() call site
+    Iterator profiled = pipe(iter_range(int, 0, 100000),
+        iter_map(_, int, x, int, x * 3),
+        iter_filter(_, int, x, x % 2 == 0));
+    printf("profiled pipe kept %zu elements\n", profiled.len);
+    flow_profile_dump(stdout);
+    printf("---\n");
+
+    // Copy-on-write sharing: consumers share one buffer and copy only when they need to write
+    Iterator shared = iter_range(int, 0, 5);
+    Iterator reader = iter_share(shared);
+    Iterator writer = iter_make_unique(iter_share(shared)); // shared, so this copies
+    ((int *)writer.data)[0] = 100;
+    printf("shared[0]=%d writer[0]=%d owners=%zu\n", ((int *)reader.data)[0], ((int *)writer.data)[0], iter_refcount(shared));
+    iter_free(shared);
+    iter_free(reader);
+    iter_free(writer);
+    printf("---\n");
+
+    // In-place variants reuse the input's buffer and take over its ownership: free the final result
+    Iterator work = iter_range(int, 0, 10);
+    work = iter_filter_inplace(work, int, x, x % 3 != 0);
+    work = iter_map_inplace(work, int, x, int, x * x);
+    work = iter_reverse_inplace(work);
+    IteratorPartitionResult halves = iter_stable_partition_inplace(work, int, x, x < 20);
+    printf("in-place: yes=");
+    iter_for(halves.yes, int, x, printf("%d ", x));
+    printf("no=");
+    iter_for(halves.no, int, x, printf("%d ", x));
+    printf("\n");
+    iter_free(halves.yes);
+    printf("---\n");
+
+    // Span tracing: compile with -DFLOW_TRACE to record every operator (and your own chunks via
+    // flow_trace_begin/flow_trace_end) per thread, then load the written file in ui.perfetto.dev.
+    // The path comes from FLOW_TRACE_PATH (default /tmp/flow-trace.json), so runs leave the tree clean.
+    uint64_t chunk_t0 = flow_trace_begin();
+    Iterator widened = iter_map(profiled, int, x, long long, x); // the running sum outgrows int
+    iter_free(iter_scan(widened, long long, x, 0, acc + x));
+    iter_free(widened);
+    flow_trace_end("chunk", chunk_t0, 0, profiled.len, profiled.len * sizeof(int));
+    #ifdef FLOW_TRACE
+    const char *trace_path = getenv("FLOW_TRACE_PATH");
+    if (!trace_path) trace_path = "/tmp/flow-trace.json";
+    FILE *trace = fopen(trace_path, "w");
+    if (trace) { flow_trace_write(trace); fclose(trace); printf("wrote %s\n", trace_path); }
+    #endif
+
     #ifdef __clang__
     // Partial application: manually curry add5 to get a function of 4 args
     __auto_type add5_curried = curry(add5, float, float, float, float, float);
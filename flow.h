@@ -9,86 +9,1096 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <time.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+#if (defined(FLOW_METRICS) || defined(FLOW_SBO_BYTES) || defined(FLOW_POOL)) && (defined(__unix__) || defined(__APPLE__))
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+#if defined(FLOW_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define _FLOW_HAS_SDT 1
+#endif
+#endif
+#if defined(FLOW_USDT) && !defined(_FLOW_HAS_SDT)
+#warning "FLOW_USDT: <sys/sdt.h> not found (install systemtap-sdt-dev); USDT probes disabled"
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+// Declare POSIX pipe(2) before the function-like pipe() macro below can clash with it.
+#include <unistd.h>
+#endif
+
+// Alignment of buffers allocated by flow.h (one cache line, one AVX-512 vector).
+#ifndef FLOW_ALIGN
+#define FLOW_ALIGN 64
+#endif
+// Buffers of at least FLOW_HUGE_THRESHOLD bytes are aligned to FLOW_HUGE_ALIGN (one huge page).
+#ifndef FLOW_HUGE_ALIGN
+#define FLOW_HUGE_ALIGN ((size_t)2 << 20)
+#endif
+#ifndef FLOW_HUGE_THRESHOLD
+#define FLOW_HUGE_THRESHOLD ((size_t)4 << 20)
+#endif
+
+// Internal: zero initializer for structs; {} in C++, where {0} warns about the other fields.
+#ifdef __cplusplus
+#define _FLOW_ZERO {}
+#else
+#define _FLOW_ZERO {0}
+#endif
+
+// Internal: report a misuse that would otherwise corrupt memory, in every build (unlike assert).
+__attribute__((noreturn, cold)) static inline void _flow_fatal(const char *msg) {
+    fprintf(stderr, "flow.h: %s\n", msg);
+    abort();
+}
+
+// Iterator fields, shared with the typed Iterator_T structs from FLOW_DEFINE_ITER.
+#define _FLOW_ITER_FIELDS(T) \
+    T *data; \
+    size_t len; \
+    size_t elem_size; \
+    size_t align; /* known alignment of data in bytes (0 = unknown) */
 
 typedef struct {
-    void *data;
-    size_t len;
-    size_t elem_size;
+    _FLOW_ITER_FIELDS(void)
 } Iterator;
 
+// Allocation hooks. Define FLOW_MALLOC(bytes, align) and FLOW_FREE(ptr) before including flow.h to
+// replace the allocator at compile time (e.g. with jemalloc's aligned allocation); FLOW_MALLOC must
+// return memory aligned to align. flow_set_allocator() swaps it at run time.
+#ifndef FLOW_MALLOC
+#if defined(__unix__) || defined(__APPLE__)
+// Internal: posix_memalign takes any size, so huge-aligned buffers are not padded to the alignment.
+static inline void *_flow_memalign(size_t bytes, size_t align) {
+    void *p = NULL;
+    return posix_memalign(&p, align, bytes) ? NULL : p;
+}
+#define FLOW_MALLOC(bytes, align) _flow_memalign((bytes), (align))
+#else
+#define FLOW_MALLOC(bytes, align) aligned_alloc((align), ((bytes) + (align) - 1) / (align) * (align))
+#endif
+#endif
+#ifndef FLOW_FREE
+#define FLOW_FREE(ptr) free(ptr)
+#endif
+
+// Operators, for per-operator statistics and trace spans: X(enum suffix, name).
+#define _FLOW_OPS(X) \
+    X(OTHER, "other") X(MAP, "map") X(FILTER, "filter") X(REVERSE, "reverse") X(UNIQUE, "unique") \
+    X(CONCAT, "concat") X(PAD, "pad") X(REPEAT, "repeat") X(ZIP, "zip") X(FLATTEN, "flatten") \
+    X(PARTITION, "partition") X(SCAN, "scan") X(RANGE, "range") X(SUM, "sum") X(FOLDL, "foldl") \
+    X(FOLDR, "foldr") X(REDUCE, "reduce_assoc") X(ANY, "any") X(ALL, "all") X(TYPED, "typed") \
+    X(ROARING, "roaring") X(DICT, "dict") X(STR, "str") X(NESTED, "nested") X(TABLE, "table") \
+    X(COPY, "copy") X(CPP, "c++")
+
+#define _FLOW_OP_ENUM(id, name) FLOW_OP_##id,
+typedef enum { _FLOW_OPS(_FLOW_OP_ENUM) FLOW_OP_COUNT } FlowOp;
+#undef _FLOW_OP_ENUM
+
+/**
+ * @brief Run-time allocator used for every buffer flow.h allocates.
+ * alloc(bytes, align, ctx) must return memory aligned to align; free(ptr, ctx) releases it.
+ */
+typedef struct {
+    void *(*alloc)(size_t bytes, size_t align, void *ctx);
+    void (*free)(void *ptr, void *ctx);
+    void *ctx;
+} FlowAllocator;
+
+// Internal: the compile-time hooks, as the default run-time allocator.
+static inline void *_flow_default_alloc(size_t bytes, size_t align, void *ctx) {
+    (void)ctx;
+    return FLOW_MALLOC(bytes, align);
+}
+static inline void _flow_default_free(void *ptr, void *ctx) {
+    (void)ctx;
+    FLOW_FREE(ptr);
+}
+
+/** @brief Allocation counters for one operator (bytes are the sizes requested). */
+typedef struct {
+    size_t allocs;
+    size_t bytes; // total bytes ever allocated
+    size_t live;  // bytes currently allocated
+} FlowOpStats;
+
+/** @brief Allocation statistics; only updated when compiled with FLOW_STATS. */
+typedef struct {
+    FlowOpStats ops[FLOW_OP_COUNT];
+    size_t allocs, frees;
+    size_t live, peak; // bytes currently allocated, and the high-water mark
+} FlowStats;
+
+// Process-wide state, weak so that every translation unit including flow.h shares one copy.
+__attribute__((weak)) FlowAllocator flow_allocator = { _flow_default_alloc, _flow_default_free, NULL };
+__attribute__((weak)) FlowStats flow_stats;
+#ifdef FLOW_PROFILE
+// Internal: bytes allocated so far by the calling thread, sampled around each profiled pipe() step.
+__attribute__((weak)) __thread size_t _flow_thread_bytes;
+#endif
+
+/**
+ * @brief Replace the allocator used by flow.h at run time.
+ * Only switch while no flow.h buffers are live, or free them with the allocator that made them.
+ * @param a The new allocator; a NULL alloc restores the compile-time default.
+ */
+static inline void flow_set_allocator(FlowAllocator a) {
+    if (!a.alloc) a = (FlowAllocator){ _flow_default_alloc, _flow_default_free, NULL };
+    flow_allocator = a;
+}
+
+#if defined(FLOW_STATS) || defined(FLOW_POOL)
+// Internal: header in front of each buffer in FLOW_STATS and FLOW_POOL modes, so frees can be
+// attributed and pooled buffers returned to their size class.
+typedef struct {
+    size_t bytes;
+    FlowOp op;
+    unsigned cls; // FLOW_POOL size class (log2 of the buffer size), 0 if not pooled
+    size_t lead;  // bytes from the start of the allocation to the data
+    unsigned magic; // _FLOW_HEADER_MAGIC, to recognise buffers from _flow_alloc
+} _FlowAllocHeader;
+#define _FLOW_HEADER_BYTES ((size_t)FLOW_ALIGN)
+#define _FLOW_HEADER_MAGIC 0x464C4F57u // "FLOW"
+#else
+#define _FLOW_HEADER_BYTES ((size_t)0)
+#endif
+
+// Buffer pool: compile with -DFLOW_POOL and buffers are rounded up to power-of-two size classes.
+// Freed buffers go to a cache owned by the freeing thread, and later allocations of the same class
+// on that thread reuse them. The cache holds at most FLOW_POOL_CACHE_BYTES per thread; beyond that,
+// and for buffers larger than 2^FLOW_POOL_MAX_CLASS bytes, buffers go back to the allocator.
+// With FLOW_POOL_RELEASE_BYTES, cached buffers of at least that size have their pages handed back
+// to the kernel (MADV_FREE) while idle. Call flow_pool_trim() before a thread exits.
+#ifdef FLOW_POOL
+#ifndef FLOW_POOL_CACHE_BYTES
+#define FLOW_POOL_CACHE_BYTES ((size_t)64 << 20)
+#endif
+#ifndef FLOW_POOL_MAX_CLASS
+#define FLOW_POOL_MAX_CLASS 30 // 1 GiB
+#endif
+#define _FLOW_POOL_MIN_CLASS 6 // 64 bytes
+
+/** @brief Pool counters of the calling thread. */
+typedef struct {
+    size_t hits, misses; // pooled allocations served from / not found in the cache
+    size_t cached;       // bytes currently held in the cache
+} FlowPoolStats;
+
+// Internal: the calling thread's cache, one free list per size class (linked through the buffers).
+typedef struct {
+    void *head[FLOW_POOL_MAX_CLASS + 1];
+    FlowPoolStats stats;
+} _FlowPool;
+__attribute__((weak)) __thread _FlowPool _flow_pool;
+
+// Internal: size class of a buffer of total bytes, or 0 if it is too large to pool (its class
+// exceeds FLOW_POOL_MAX_CLASS or would not fit in the FLOW_POOL_CACHE_BYTES cache).
+static inline unsigned _flow_pool_class(size_t total) {
+    if (total > ((size_t)1 << FLOW_POOL_MAX_CLASS)) return 0;
+    unsigned cls = total > 1 ? 64 - (unsigned)__builtin_clzll((unsigned long long)total - 1) : 0;
+    if (cls < _FLOW_POOL_MIN_CLASS) cls = _FLOW_POOL_MIN_CLASS;
+    return ((size_t)1 << cls) > FLOW_POOL_CACHE_BYTES ? 0 : cls;
+}
+
+// Internal: a cached buffer of class cls, or NULL.
+static inline void *_flow_pool_take(unsigned cls) {
+    void *p = _flow_pool.head[cls];
+    if (!p) {
+        ++_flow_pool.stats.misses;
+        return NULL;
+    }
+    _flow_pool.head[cls] = *(void **)p;
+    _flow_pool.stats.cached -= (size_t)1 << cls;
+    ++_flow_pool.stats.hits;
+    return p;
+}
+
+// Internal: cache a buffer of class cls; 0 if the cache is full and the caller must free it.
+static inline int _flow_pool_give(void *p, unsigned cls) {
+    size_t size = (size_t)1 << cls;
+    if (_flow_pool.stats.cached + size > FLOW_POOL_CACHE_BYTES) return 0;
+#if defined(FLOW_POOL_RELEASE_BYTES) && defined(__linux__)
+    if (size >= (size_t)(FLOW_POOL_RELEASE_BYTES)) {
+        // Keep the first page: it holds the free-list link.
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        uintptr_t lo = ((uintptr_t)p + page) & ~(uintptr_t)(page - 1), hi = ((uintptr_t)p + size) & ~(uintptr_t)(page - 1);
+#ifdef MADV_FREE
+        if (hi > lo) madvise((void *)lo, hi - lo, MADV_FREE);
+#else
+        if (hi > lo) madvise((void *)lo, hi - lo, MADV_DONTNEED);
+#endif
+    }
+#endif
+    *(void **)p = _flow_pool.head[cls];
+    _flow_pool.head[cls] = p;
+    _flow_pool.stats.cached += size;
+    return 1;
+}
+#endif
+
+// Small buffers: compile with -DFLOW_SBO_BYTES=64 (any size) and outputs of at most that many
+// bytes skip the allocator. They are cut from one reserved address range (FLOW_SBO_REGION bytes
+// of address space, committed as it is touched) into fixed FLOW_ALIGN-aligned blocks. Each thread
+// bump-allocates from its own chunk of the range and recycles blocks through a private free list,
+// so an allocation or free is a few instructions without locks. flow_free() recognises small
+// blocks by address; once the range is used up, small buffers fall back to the allocator.
+// A block joins the free list of the thread that frees it, which in a producer/consumer pipeline
+// is not the thread that allocates. A thread holding more than FLOW_SBO_LOCAL_BLOCKS free blocks
+// therefore hands them, as one batch under a lock, to a shared list that allocating threads
+// refill from. A thread's own list and the unused rest of its chunk are lost when it exits, unless
+// it calls flow_sbo_trim() first.
+#ifdef FLOW_SBO_BYTES
+#ifndef FLOW_SBO_REGION
+#define FLOW_SBO_REGION ((size_t)256 << 20)
+#endif
+#ifndef FLOW_SBO_LOCAL_BLOCKS
+#define FLOW_SBO_LOCAL_BLOCKS 1024 // free blocks a thread keeps before sharing them
+#endif
+#define _FLOW_SBO_BLOCK (((size_t)(FLOW_SBO_BYTES) + _FLOW_HEADER_BYTES + FLOW_ALIGN - 1) / FLOW_ALIGN * FLOW_ALIGN)
+#define _FLOW_SBO_CHUNK ((size_t)64 << 10) // bytes a thread claims from the range at a time
+#define _FLOW_SBO_NONE ((char *)-1)        // the range could not be reserved (== MAP_FAILED)
+
+// Internal: the reserved range (NULL until first use, _FLOW_SBO_NONE if it could not be reserved),
+// the next unclaimed offset, each thread's free list (head, tail, length) and bump chunk, and the
+// shared stack of spilled batches with its spinlock.
+__attribute__((weak)) char *_flow_sbo_base;
+__attribute__((weak)) size_t _flow_sbo_claimed;
+__attribute__((weak)) __thread void *_flow_sbo_free, *_flow_sbo_tail;
+__attribute__((weak)) __thread size_t _flow_sbo_nfree;
+__attribute__((weak)) __thread char *_flow_sbo_cur, *_flow_sbo_end;
+__attribute__((weak)) void *_flow_sbo_batches;
+__attribute__((weak)) char _flow_sbo_lock;
+
+// Internal: a spilled batch is a free list whose head block also records the next batch, its
+// tail and its length.
+typedef struct {
+    void *next, *next_batch, *tail;
+    size_t len;
+} _FlowSboBatch;
+
+// Internal: reserve the range once; concurrent first callers race, and the loser unmaps its copy.
+static inline char *_flow_sbo_reserve(void) {
+    char *base = __atomic_load_n(&_flow_sbo_base, __ATOMIC_ACQUIRE);
+    if (base) return base;
+#if defined(__unix__) || defined(__APPLE__)
+    char *p = (char *)mmap(NULL, FLOW_SBO_REGION, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+#else
+    char *p = _FLOW_SBO_NONE;
+#endif
+    if (!__atomic_compare_exchange_n(&_flow_sbo_base, &base, p, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        if (p != _FLOW_SBO_NONE) munmap(p, FLOW_SBO_REGION);
+        return base;
+    }
+    return p;
+}
+
+// Internal: move the calling thread's free list to the shared stack as one batch.
+static inline void _flow_sbo_spill(void) {
+    _FlowSboBatch *b = (_FlowSboBatch *)_flow_sbo_free;
+    if (!b) return;
+    b->tail = _flow_sbo_tail;
+    b->len = _flow_sbo_nfree;
+    while (__atomic_test_and_set(&_flow_sbo_lock, __ATOMIC_ACQUIRE)) {}
+    b->next_batch = _flow_sbo_batches;
+    __atomic_store_n(&_flow_sbo_batches, (void *)b, __ATOMIC_RELAXED);
+    __atomic_clear(&_flow_sbo_lock, __ATOMIC_RELEASE);
+    _flow_sbo_free = _flow_sbo_tail = NULL;
+    _flow_sbo_nfree = 0;
+}
+
+// Internal: put a small block on the calling thread's free list, spilling the list when it is full.
+static inline void _flow_sbo_release(void *p) {
+    if (!_flow_sbo_free) _flow_sbo_tail = p;
+    *(void **)p = _flow_sbo_free;
+    _flow_sbo_free = p;
+    if (++_flow_sbo_nfree > FLOW_SBO_LOCAL_BLOCKS) _flow_sbo_spill();
+}
+
+// Internal: one small block, or NULL when the range is exhausted or unavailable.
+static inline void *_flow_sbo_alloc(void) {
+    void *b = _flow_sbo_free;
+    if (!b && __atomic_load_n(&_flow_sbo_batches, __ATOMIC_RELAXED)) {
+        // Adopt a batch spilled by another thread.
+        while (__atomic_test_and_set(&_flow_sbo_lock, __ATOMIC_ACQUIRE)) {}
+        _FlowSboBatch *batch = (_FlowSboBatch *)_flow_sbo_batches;
+        if (batch) __atomic_store_n(&_flow_sbo_batches, batch->next_batch, __ATOMIC_RELAXED);
+        __atomic_clear(&_flow_sbo_lock, __ATOMIC_RELEASE);
+        if (batch) {
+            b = batch;
+            _flow_sbo_tail = batch->tail;
+            _flow_sbo_nfree = batch->len;
+        }
+    }
+    if (b) {
+        _flow_sbo_free = *(void **)b;
+        --_flow_sbo_nfree;
+        return b;
+    }
+    if (_flow_sbo_cur == _flow_sbo_end) {
+        char *base = _flow_sbo_reserve();
+        if (base == _FLOW_SBO_NONE) return NULL;
+        size_t off = __atomic_fetch_add(&_flow_sbo_claimed, _FLOW_SBO_CHUNK, __ATOMIC_RELAXED);
+        if (off + _FLOW_SBO_CHUNK > FLOW_SBO_REGION) return NULL;
+        _flow_sbo_cur = base + off;
+        _flow_sbo_end = base + off + _FLOW_SBO_CHUNK / _FLOW_SBO_BLOCK * _FLOW_SBO_BLOCK;
+    }
+    b = _flow_sbo_cur;
+    _flow_sbo_cur += _FLOW_SBO_BLOCK;
+    return b;
+}
+
+// Internal: 1 if p is a small block (blocks freed on another thread join that thread's list).
+static inline int _flow_sbo_owns(const void *p) {
+    const char *base = __atomic_load_n(&_flow_sbo_base, __ATOMIC_RELAXED);
+    return base && base != _FLOW_SBO_NONE && (const char *)p >= base && (const char *)p < base + FLOW_SBO_REGION;
+}
+
+/** @brief Hand the calling thread's free small blocks and unused chunk to other threads (call before the thread exits). */
+static inline void flow_sbo_trim(void) {
+    for (; _flow_sbo_cur != _flow_sbo_end; _flow_sbo_cur += _FLOW_SBO_BLOCK) {
+        if (!_flow_sbo_free) _flow_sbo_tail = _flow_sbo_cur;
+        *(void **)_flow_sbo_cur = _flow_sbo_free;
+        _flow_sbo_free = _flow_sbo_cur;
+        ++_flow_sbo_nfree;
+    }
+    _flow_sbo_spill();
+}
+#endif
+
+// Shared buffers: iter_share() lets several owners hold one buffer. A registry of the shared
+// buffers' address ranges counts their owners. Ownership is decided by the start pointer: an
+// iterator whose data is the start of a registered buffer is an owning handle (whatever its
+// length), and a pointer inside the range (iter_slice, iter_drop, ...) is a view of it. flow_free()
+// of a shared buffer only drops a reference until the last owner releases it, and
+// iter_make_unique() copies the buffer only while it is shared. Buffers that were never shared
+// cost one relaxed load in flow_free().
+#ifndef FLOW_SHARE_SLOTS
+#define FLOW_SHARE_SLOTS 4096 // buffers that can be shared at the same time
+#endif
+
+// Internal: registry entry; the range [ptr, ptr + bytes) has refs owners.
+typedef struct {
+    char *ptr;
+    size_t bytes;
+    size_t refs;
+} _FlowShareEntry;
+
+// Internal: registry shared by every translation unit, sorted by ptr and guarded by a spinlock.
+__attribute__((weak)) _FlowShareEntry _flow_share_table[FLOW_SHARE_SLOTS];
+__attribute__((weak)) size_t _flow_share_live;
+__attribute__((weak)) char _flow_share_lock;
+
+static inline void _flow_share_acquire(void) {
+    while (__atomic_test_and_set(&_flow_share_lock, __ATOMIC_ACQUIRE)) {}
+}
+static inline void _flow_share_unlock(void) { __atomic_clear(&_flow_share_lock, __ATOMIC_RELEASE); }
+
+// Internal: number of entries starting at or before ptr; the entry owning ptr, if any, is the last of them.
+static inline size_t _flow_share_rank(const void *ptr) {
+    size_t lo = 0, hi = _flow_share_live;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (_flow_share_table[mid].ptr <= (const char *)ptr) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Internal: entry whose range holds ptr (a zero-byte buffer holds its own address), or NULL.
+static inline _FlowShareEntry *_flow_share_find(const void *ptr) {
+    size_t i = _flow_share_rank(ptr);
+    if (!i) return NULL;
+    _FlowShareEntry *e = &_flow_share_table[i - 1];
+    const char *p = (const char *)ptr;
+    return p == e->ptr || p < e->ptr + e->bytes ? e : NULL;
+}
+
+// Internal: 0 if ptr is certainly not the start of a _flow_alloc buffer. This is only checkable
+// for small blocks and for buffers with a FLOW_STATS/FLOW_POOL header; anything else passes.
+static inline int _flow_alloc_start(const void *ptr) {
+#ifdef FLOW_SBO_BYTES
+    if (_flow_sbo_owns(ptr))
+        return (size_t)((const char *)ptr - _FLOW_HEADER_BYTES - _flow_sbo_base) % _FLOW_SBO_CHUNK % _FLOW_SBO_BLOCK == 0;
+#endif
+#if defined(FLOW_STATS) || defined(FLOW_POOL)
+    return ((const _FlowAllocHeader *)((const char *)ptr - _FLOW_HEADER_BYTES))->magic == _FLOW_HEADER_MAGIC;
+#else
+    (void)ptr;
+    return 1;
+#endif
+}
+
+// Internal: add an owner to the buffer starting at ptr, registering [ptr, ptr + bytes) on its
+// first share; 0 if the registry is full (the caller copies instead). A pointer into a shared
+// buffer other than its start, or one that is not a flow.h allocation, is rejected.
+static inline int _flow_share_add(void *ptr, size_t bytes) {
+    _flow_share_acquire();
+    _FlowShareEntry *e = _flow_share_find(ptr);
+    int ok = e || _flow_share_live < FLOW_SHARE_SLOTS;
+    if (e && e->ptr != (char *)ptr) {
+        _flow_share_unlock();
+        _flow_fatal("iter_share: a view into a shared buffer cannot be shared; share its owning handle");
+    }
+    if (!e && !_flow_alloc_start(ptr)) {
+        _flow_share_unlock();
+        _flow_fatal("iter_share: the iterator does not own a flow.h buffer (a view or a user array)");
+    }
+    if (e) {
+        ++e->refs;
+        if (bytes > e->bytes) e->bytes = bytes;
+    } else if (ok) {
+        size_t i = _flow_share_rank(ptr);
+        memmove(&_flow_share_table[i + 1], &_flow_share_table[i], (_flow_share_live - i) * sizeof(_FlowShareEntry));
+        _flow_share_table[i] = (_FlowShareEntry){ (char *)ptr, bytes, 2 };
+        __atomic_store_n(&_flow_share_live, _flow_share_live + 1, __ATOMIC_RELEASE);
+    }
+    _flow_share_unlock();
+    return ok;
+}
+
+// Internal: number of owners of the buffer holding ptr.
+static inline size_t _flow_share_refs(const void *ptr) {
+    if (!__atomic_load_n(&_flow_share_live, __ATOMIC_ACQUIRE)) return 1;
+    _flow_share_acquire();
+    _FlowShareEntry *e = _flow_share_find(ptr);
+    size_t refs = e ? e->refs : 1;
+    _flow_share_unlock();
+    return refs;
+}
+
+// Internal: how iter_make_unique must treat ptr: 0 if its bytes may be written in place, 1 if it
+// is a view into a buffer with other owners, 2 if it is the owning handle of such a buffer (copy
+// and drop this owner's reference).
+static inline int _flow_share_state(const void *ptr) {
+    if (!__atomic_load_n(&_flow_share_live, __ATOMIC_ACQUIRE)) return 0;
+    _flow_share_acquire();
+    _FlowShareEntry *e = _flow_share_find(ptr);
+    int state = !e || e->refs < 2 ? 0 : (const char *)ptr == e->ptr ? 2 : 1;
+    _flow_share_unlock();
+    return state;
+}
+
+// Internal: drop one owner of the buffer holding *ptr; 1 if others remain (the buffer must not be
+// freed yet). When the last owner goes, *ptr is set to the start of the buffer for the caller to free.
+static inline int _flow_share_release(void **ptr) {
+    _flow_share_acquire();
+    _FlowShareEntry *e = _flow_share_find(*ptr);
+    int shared = e && --e->refs > 0;
+    if (e && !shared) {
+        *ptr = e->ptr;
+        size_t i = (size_t)(e - _flow_share_table);
+        memmove(e, e + 1, (_flow_share_live - i - 1) * sizeof(_FlowShareEntry));
+        __atomic_store_n(&_flow_share_live, _flow_share_live - 1, __ATOMIC_RELEASE);
+    }
+    _flow_share_unlock();
+    return shared;
+}
+
+// Internal: allocate a buffer aligned to FLOW_ALIGN (FLOW_HUGE_ALIGN for large buffers) on behalf of op.
+// The result is always released with flow_free(), never free(): it may carry a FLOW_STATS/FLOW_POOL
+// header, be a FLOW_SBO_BYTES block, or be shared through iter_share.
+static inline void *_flow_alloc(FlowOp op, size_t bytes) {
+    size_t align = bytes >= FLOW_HUGE_THRESHOLD ? FLOW_HUGE_ALIGN : FLOW_ALIGN;
+    size_t total = bytes + _FLOW_HEADER_BYTES;
+    size_t rounded = total ? (total + FLOW_ALIGN - 1) / FLOW_ALIGN * FLOW_ALIGN : FLOW_ALIGN; // whole cache lines
+    size_t lead = _FLOW_HEADER_BYTES;
+    char *p = NULL;
+    unsigned cls = 0;
+#ifdef FLOW_SBO_BYTES
+    if (total <= _FLOW_SBO_BLOCK) p = (char *)_flow_sbo_alloc();
+#endif
+#ifdef FLOW_POOL
+    if (!p && (cls = _flow_pool_class(total))) {
+        rounded = (size_t)1 << cls;
+        align = rounded >= FLOW_HUGE_THRESHOLD ? FLOW_HUGE_ALIGN : FLOW_ALIGN;
+    }
+#endif
+#if defined(FLOW_STATS) || defined(FLOW_POOL)
+    // A header in front of a huge buffer would push its data off the FLOW_HUGE_ALIGN boundary, so
+    // such buffers start with a whole alignment unit whose last bytes hold the header.
+    if (align > FLOW_ALIGN) lead = align, rounded += align - _FLOW_HEADER_BYTES;
+#endif
+#ifdef FLOW_POOL
+    if (cls) p = (char *)_flow_pool_take(cls);
+#endif
+    if (!p) {
+        p = (char *)flow_allocator.alloc(rounded, align, flow_allocator.ctx);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        // Only the data is backed by huge pages; a leading header keeps a small page of its own.
+        if (p && align == FLOW_HUGE_ALIGN) madvise(p + lead, rounded - lead, MADV_HUGEPAGE);
+#endif
+    }
+#if defined(FLOW_STATS) || defined(FLOW_POOL)
+    if (!p) return NULL;
+    p += lead;
+    *(_FlowAllocHeader *)(p - _FLOW_HEADER_BYTES) = (_FlowAllocHeader){ .bytes = bytes, .op = op, .cls = cls, .lead = lead, .magic = _FLOW_HEADER_MAGIC };
+#else
+    (void)cls, (void)lead;
+#endif
+#ifdef FLOW_STATS
+    __atomic_fetch_add(&flow_stats.ops[op].allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&flow_stats.ops[op].bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&flow_stats.ops[op].live, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&flow_stats.allocs, 1, __ATOMIC_RELAXED);
+    size_t live = __atomic_add_fetch(&flow_stats.live, bytes, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&flow_stats.peak, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&flow_stats.peak, &peak, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+#else
+    (void)op;
+#endif
+#ifdef FLOW_PROFILE
+    if (p) _flow_thread_bytes += bytes;
+#endif
+    return p;
+}
+
+/**
+ * @brief Release a buffer returned by any flow.h operator (the data of an output Iterator,
+ * dictionary arenas, ...). Always use it (or iter_free) instead of free().
+ * @param ptr The buffer (NULL is ignored).
+ */
+static inline void flow_free(void *ptr) {
+    if (!ptr) return;
+    if (__atomic_load_n(&_flow_share_live, __ATOMIC_ACQUIRE) && _flow_share_release(&ptr)) return;
+#if defined(FLOW_STATS) || defined(FLOW_POOL)
+    _FlowAllocHeader h = *(_FlowAllocHeader *)((char *)ptr - _FLOW_HEADER_BYTES);
+    ptr = (char *)ptr - h.lead;
+#endif
+#ifdef FLOW_STATS
+    __atomic_fetch_sub(&flow_stats.ops[h.op].live, h.bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&flow_stats.live, h.bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&flow_stats.frees, 1, __ATOMIC_RELAXED);
+#endif
+#ifdef FLOW_SBO_BYTES
+    if (_flow_sbo_owns(ptr)) {
+        _flow_sbo_release(ptr);
+        return;
+    }
+#endif
+#ifdef FLOW_POOL
+    if (h.cls && _flow_pool_give(ptr, h.cls)) return;
+#endif
+    flow_allocator.free(ptr, flow_allocator.ctx);
+}
+
+#ifdef FLOW_POOL
+/** @brief Release every buffer cached by the calling thread (call before the thread exits). */
+static inline void flow_pool_trim(void) {
+    for (unsigned cls = 0; cls <= FLOW_POOL_MAX_CLASS; ++cls)
+        while (_flow_pool.head[cls]) {
+            void *p = _flow_pool.head[cls];
+            _flow_pool.head[cls] = *(void **)p;
+            flow_allocator.free(p, flow_allocator.ctx);
+        }
+    _flow_pool.stats.cached = 0;
+}
+
+/** @brief Hit/miss counters and cached bytes of the calling thread's pool. */
+static inline FlowPoolStats flow_pool_stats(void) { return _flow_pool.stats; }
+#endif
+
+// Internal: zero-initialised _flow_alloc.
+static inline void *_flow_calloc(FlowOp op, size_t n, size_t size) {
+    void *p = _flow_alloc(op, n * size);
+    if (p) memset(p, 0, n * size);
+    return p;
+}
+
+// Internal: grow a _flow_alloc buffer, keeping its first old_bytes bytes.
+static inline void *_flow_realloc(FlowOp op, void *ptr, size_t old_bytes, size_t new_bytes) {
+    void *p = _flow_alloc(op, new_bytes);
+    if (p && ptr) memcpy(p, ptr, old_bytes < new_bytes ? old_bytes : new_bytes);
+    flow_free(ptr);
+    return p;
+}
+
+/**
+ * @brief Release the buffer of an Iterator produced by a flow.h operator (not of a view).
+ * @param it The iterator (plain or typed handle).
+ */
+#define iter_free(it) flow_free(FLOW_ITER(it).data)
+
+// Internal: private copy of a buffer, for iter_share/iter_make_unique.
+static inline void *_flow_copy_buffer(const void *src, size_t bytes) {
+    void *p = _flow_alloc(FLOW_OP_COPY, bytes);
+    if (p) memcpy(p, src, bytes);
+    return p;
+}
+
+/**
+ * @brief Add an owner to the buffer of an Iterator produced by a flow.h operator, so it can be
+ * handed to another consumer without a defensive copy. Every owner releases it with iter_free();
+ * the memory goes away with the last one. Only an owning handle (data at the start of the buffer)
+ * can be shared: a view into a shared buffer aborts the program, and so does a view or user array
+ * that is detectably not a flow.h buffer (small blocks, and FLOW_STATS/FLOW_POOL builds).
+ * If the registry is full (FLOW_SHARE_SLOTS), the new owner gets a private copy instead.
+ * @param it The iterator (plain or typed handle).
+ * @return The same iterator, now with one more owner.
+ */
+#define iter_share(it) \
+    ({ \
+        __auto_type _sh = (it); \
+        Iterator _sv = FLOW_ITER(_sh); \
+        if (_sv.data && !_flow_share_add(_sv.data, _sv.len * _sv.elem_size)) \
+            _sh.data = (typeof(_sh.data))_flow_copy_buffer(_sv.data, _sv.len * _sv.elem_size); \
+        _sh; \
+    })
+
+/**
+ * @brief Get a buffer the caller may write in place, with the same ownership as the input: the
+ * iterator itself unless it is the owning handle of a shared buffer, in which case it gets a
+ * private copy and gives up its reference. A view into a shared buffer (iter_slice, iter_drop,
+ * ...) aborts the program: writing it would change the other owners' data, and a copy would be a
+ * buffer the caller does not expect to free.
+ * @param it The iterator (plain or typed handle).
+ * @return An iterator whose bytes no one else sees; free it exactly when the input needed freeing.
+ */
+#define iter_make_unique(it) \
+    ({ \
+        __auto_type _mu = (it); \
+        Iterator _mv = FLOW_ITER(_mu); \
+        int _ms = _mv.data ? _flow_share_state(_mv.data) : 0; \
+        if (_ms == 1) _flow_fatal("write to a view of a shared buffer; iter_make_unique its owning handle first"); \
+        if (_ms == 2) { \
+            _mu.data = (typeof(_mu.data))_flow_copy_buffer(_mv.data, _mv.len * _mv.elem_size); \
+            _mu.align = FLOW_ALIGN; \
+            flow_free(_mv.data); \
+        } \
+        _mu; \
+    })
+
+/** @brief Number of owners of the buffer an iterator (or view) points into (1 unless shared with iter_share). */
+#define iter_refcount(it) _flow_share_refs(FLOW_ITER(it).data)
+
+static inline const char *flow_op_name(FlowOp op) {
+#define _FLOW_OP_NAME(id, name) name,
+    static const char *const names[] = { _FLOW_OPS(_FLOW_OP_NAME) };
+#undef _FLOW_OP_NAME
+    return (unsigned)op < FLOW_OP_COUNT ? names[op] : "?";
+}
+
+/** @brief Snapshot of the allocation statistics (all zero unless compiled with FLOW_STATS). */
+static inline FlowStats flow_stats_get(void) {
+    FlowStats s;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    memcpy(&s, &flow_stats, sizeof(s));
+    return s;
+}
+
+/** @brief Reset the totals and the peak to the current live bytes; live counters are kept. */
+static inline void flow_stats_reset(void) {
+    for (size_t i = 0; i < FLOW_OP_COUNT; ++i) {
+        __atomic_store_n(&flow_stats.ops[i].allocs, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&flow_stats.ops[i].bytes, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&flow_stats.allocs, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&flow_stats.frees, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&flow_stats.peak, __atomic_load_n(&flow_stats.live, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Print the allocation statistics, one line per operator that allocated.
+ * @param out Destination stream (e.g. stderr).
+ */
+static inline void flow_stats_print(FILE *out) {
+#ifndef FLOW_STATS
+    fprintf(out, "flow stats: disabled (compile with -DFLOW_STATS)\n");
+    return;
+#endif
+    FlowStats s = flow_stats_get();
+    fprintf(out, "flow stats: %zu allocs, %zu frees, live %zu bytes, peak %zu bytes\n", s.allocs, s.frees, s.live, s.peak);
+    for (size_t i = 0; i < FLOW_OP_COUNT; ++i)
+        if (s.ops[i].allocs)
+            fprintf(out, "  %-10s %10zu allocs %14zu bytes %14zu live\n", flow_op_name((FlowOp)i), s.ops[i].allocs, s.ops[i].bytes, s.ops[i].live);
+}
+
+// Internal: monotonic clock in nanoseconds.
+static inline uint64_t _flow_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Span tracer: compile with -DFLOW_TRACE and every operator records a span (operator name,
+// element range, bytes) into a buffer owned by the calling thread; flow_trace_begin() and
+// flow_trace_end() add spans for your own chunks and tasks. flow_trace_write(file) writes
+// Chrome trace-event JSON for Perfetto (ui.perfetto.dev) or chrome://tracing.
+#ifndef FLOW_TRACE_EVENTS
+#define FLOW_TRACE_EVENTS 65536 // spans kept per thread; later ones are counted as dropped
+#endif
+
+/** @brief One recorded span: [lo, hi) is the element range, bytes the bytes it read. */
+typedef struct {
+    const char *name; // must outlive the trace (string literals, flow_op_name)
+    uint64_t ts, dur; // monotonic nanoseconds
+    size_t lo, hi, bytes;
+} FlowTraceEvent;
+
+/** @brief Span buffer of one thread; only that thread appends, readers see the first len events. */
+typedef struct FlowTraceBuffer {
+    struct FlowTraceBuffer *next;
+    unsigned tid;
+    size_t len, dropped;
+    FlowTraceEvent events[FLOW_TRACE_EVENTS];
+} FlowTraceBuffer;
+
+// Every thread's buffer, shared by every translation unit. Buffers outlive their threads so the
+// trace can be written after workers have exited.
+__attribute__((weak)) FlowTraceBuffer *flow_trace_buffers;
+__attribute__((weak)) unsigned _flow_trace_threads;
+#ifdef FLOW_TRACE
+__attribute__((weak)) __thread FlowTraceBuffer *_flow_trace_local;
+#endif
+
+// Internal: append one span to the calling thread's buffer, creating it on first use.
+static inline void _flow_trace_record(const char *name, uint64_t t0, uint64_t t1, size_t lo, size_t hi, size_t bytes) {
+#ifdef FLOW_TRACE
+    FlowTraceBuffer *b = _flow_trace_local;
+    if (!b) {
+        b = (FlowTraceBuffer *)calloc(1, sizeof(FlowTraceBuffer));
+        if (!b) return;
+        b->tid = __atomic_add_fetch(&_flow_trace_threads, 1, __ATOMIC_RELAXED);
+        b->next = __atomic_load_n(&flow_trace_buffers, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&flow_trace_buffers, &b->next, b, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+        _flow_trace_local = b;
+    }
+    size_t len = b->len;
+    if (len == FLOW_TRACE_EVENTS) { ++b->dropped; return; }
+    b->events[len] = (FlowTraceEvent){ name, t0, t1 - t0, lo, hi, bytes };
+    __atomic_store_n(&b->len, len + 1, __ATOMIC_RELEASE);
+#else
+    (void)name; (void)t0; (void)t1; (void)lo; (void)hi; (void)bytes;
+#endif
+}
+
+/** @brief Start a span; pass the result to flow_trace_end(). */
+static inline uint64_t flow_trace_begin(void) {
+#ifdef FLOW_TRACE
+    return _flow_now_ns();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Record a span of your own (a chunk, task or stage) on the calling thread.
+ * Does nothing unless compiled with FLOW_TRACE.
+ * @param name Span name; must stay valid until the trace is written.
+ * @param t0 The value returned by flow_trace_begin().
+ * @param lo First element of the range the span worked on.
+ * @param hi One past the last element.
+ * @param bytes Bytes the span processed.
+ */
+static inline void flow_trace_end(const char *name, uint64_t t0, size_t lo, size_t hi, size_t bytes) {
+#ifdef FLOW_TRACE
+    _flow_trace_record(name, t0, _flow_now_ns(), lo, hi, bytes);
+#else
+    (void)name; (void)t0; (void)lo; (void)hi; (void)bytes;
+#endif
+}
+
+/** @brief Forget every recorded span; call while no other thread is recording. */
+static inline void flow_trace_reset(void) {
+    for (FlowTraceBuffer *b = __atomic_load_n(&flow_trace_buffers, __ATOMIC_ACQUIRE); b; b = b->next) {
+        __atomic_store_n(&b->len, 0, __ATOMIC_RELEASE);
+        b->dropped = 0;
+    }
+}
+
+// Live metrics: compile with -DFLOW_METRICS and every operator adds its calls, elements, bytes
+// and nanoseconds to counters in a POSIX shared-memory segment ("/flow.<pid>" unless
+// flow_metrics_open() names another), which tools/flow_metrics.c samples from outside the
+// process. Each thread owns a slot of counters, so the hot path never contends.
+#ifndef FLOW_METRICS_SLOTS
+#define FLOW_METRICS_SLOTS 64 // threads beyond this share the last slot
+#endif
+#define FLOW_METRICS_MAGIC 0x574f4c46u // "FLOW"
+#define FLOW_METRICS_VERSION 1
+
+/** @brief Counters of one operator; only ever increase. */
+typedef struct {
+    uint64_t calls, elems, bytes, ns;
+} FlowOpCounters;
+
+/** @brief One thread's counters, on its own cache lines. */
+typedef struct {
+    FlowOpCounters ops[FLOW_OP_COUNT];
+} __attribute__((aligned(64))) FlowMetricsSlot;
+
+/** @brief Layout of the shared-memory segment; readers check magic, version and nops first. */
+typedef struct {
+    uint32_t magic, version, nops, nslots;
+    uint32_t used; // slots handed out so far
+    int32_t pid;
+    char names[FLOW_OP_COUNT][16];
+    FlowMetricsSlot slots[FLOW_METRICS_SLOTS];
+} FlowMetrics;
+
+// The mapped segment (NULL until opened) and its name, shared by every translation unit.
+__attribute__((weak)) FlowMetrics *flow_metrics;
+__attribute__((weak)) char _flow_metrics_name[64];
+__attribute__((weak)) int _flow_metrics_state; // 0 closed, 1 opening, 2 open, 3 failed
+#ifdef FLOW_METRICS
+__attribute__((weak)) __thread FlowMetricsSlot *_flow_metrics_slot;
+#endif
+
+/** @brief Remove the metrics segment so no new reader can attach (run at exit when it was opened implicitly). */
+static inline void flow_metrics_close(void) {
+#if defined(FLOW_METRICS) && (defined(__unix__) || defined(__APPLE__))
+    if (__atomic_load_n(&_flow_metrics_state, __ATOMIC_ACQUIRE) != 2) return;
+    shm_unlink(_flow_metrics_name);
+    __atomic_store_n(&_flow_metrics_state, 3, __ATOMIC_RELEASE);
+#endif
+}
+
+/**
+ * @brief Create the metrics segment under a chosen name before any operator runs.
+ * Does nothing unless compiled with FLOW_METRICS; later calls keep the first segment.
+ * @param name POSIX shared-memory name such as "/flow.myservice" (NULL = "/flow.<pid>").
+ * @return 0 on success, -1 if the segment could not be created.
+ */
+static inline int flow_metrics_open(const char *name) {
+#if defined(FLOW_METRICS) && (defined(__unix__) || defined(__APPLE__))
+    int state = 0;
+    if (!__atomic_compare_exchange_n(&_flow_metrics_state, &state, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        while (state == 1) state = __atomic_load_n(&_flow_metrics_state, __ATOMIC_ACQUIRE);
+        return state == 2 ? 0 : -1;
+    }
+    if (name) snprintf(_flow_metrics_name, sizeof(_flow_metrics_name), "%s", name);
+    else snprintf(_flow_metrics_name, sizeof(_flow_metrics_name), "/flow.%d", (int)getpid());
+    FlowMetrics *m = NULL;
+    int fd = shm_open(_flow_metrics_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd >= 0 && ftruncate(fd, sizeof(FlowMetrics)) == 0) {
+        void *p = mmap(NULL, sizeof(FlowMetrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) m = (FlowMetrics *)p;
+    }
+    if (fd >= 0) close(fd);
+    if (!m) {
+        if (fd >= 0) shm_unlink(_flow_metrics_name);
+        __atomic_store_n(&_flow_metrics_state, 3, __ATOMIC_RELEASE);
+        return -1;
+    }
+    m->version = FLOW_METRICS_VERSION;
+    m->nops = FLOW_OP_COUNT;
+    m->nslots = FLOW_METRICS_SLOTS;
+    m->pid = (int32_t)getpid();
+    for (size_t i = 0; i < FLOW_OP_COUNT; ++i) snprintf(m->names[i], sizeof(m->names[i]), "%s", flow_op_name((FlowOp)i));
+    __atomic_store_n(&m->magic, FLOW_METRICS_MAGIC, __ATOMIC_RELEASE);
+    flow_metrics = m;
+    __atomic_store_n(&_flow_metrics_state, 2, __ATOMIC_RELEASE);
+    if (!name) atexit(flow_metrics_close);
+    return 0;
+#else
+    (void)name;
+    return -1;
+#endif
+}
+
+// Internal: add one operator call to the calling thread's slot, opening the segment on first use.
+static inline void _flow_metrics_record(FlowOp op, size_t n, size_t bytes, uint64_t ns) {
+#ifdef FLOW_METRICS
+    FlowMetricsSlot *slot = _flow_metrics_slot;
+    if (!slot) {
+        if (__atomic_load_n(&_flow_metrics_state, __ATOMIC_ACQUIRE) != 2 && flow_metrics_open(NULL)) return;
+        uint32_t i = __atomic_fetch_add(&flow_metrics->used, 1, __ATOMIC_RELAXED);
+        slot = _flow_metrics_slot = &flow_metrics->slots[i < FLOW_METRICS_SLOTS ? i : FLOW_METRICS_SLOTS - 1];
+    }
+    FlowOpCounters *c = &slot->ops[op];
+    if (slot != &flow_metrics->slots[FLOW_METRICS_SLOTS - 1]) {
+        // Sole writer: plain loads and stores, kept atomic so readers never see torn values.
+        __atomic_store_n(&c->calls, __atomic_load_n(&c->calls, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&c->elems, __atomic_load_n(&c->elems, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+        __atomic_store_n(&c->bytes, __atomic_load_n(&c->bytes, __ATOMIC_RELAXED) + bytes, __ATOMIC_RELAXED);
+        __atomic_store_n(&c->ns, __atomic_load_n(&c->ns, __ATOMIC_RELAXED) + ns, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&c->calls, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&c->elems, n, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&c->bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&c->ns, ns, __ATOMIC_RELAXED);
+    }
+#else
+    (void)op; (void)n; (void)bytes; (void)ns;
+#endif
+}
+
+// Internal: end of a timed operator, feeding the tracer and the metrics.
+static inline void _flow_op_timed(FlowOp op, uint64_t t0, size_t n, size_t elem_size) {
+    uint64_t t1 = _flow_now_ns();
+#ifdef FLOW_TRACE
+    _flow_trace_record(flow_op_name(op), t0, t1, 0, n, n * elem_size);
+#endif
+    _flow_metrics_record(op, n, n * elem_size, t1 - t0);
+}
+
+// Internal: USDT probe flow:name with three integer arguments (a nop until a tracer attaches).
+#ifdef _FLOW_HAS_SDT
+#define _FLOW_USDT3(name, a, b, c) STAP_PROBE3(flow, name, a, b, c)
+#else
+#define _FLOW_USDT3(name, a, b, c) (void)0
+#endif
+
+// Internal: operator hooks, bracketing the work of each operator over n elements of elem_size
+// bytes. They compile to nothing unless FLOW_TRACE, FLOW_METRICS or FLOW_USDT is enabled.
+#if defined(FLOW_TRACE) || defined(FLOW_METRICS)
+#define _FLOW_TIMED_OP_BEGIN() uint64_t _flow_op_t0 = _flow_now_ns()
+#define _FLOW_TIMED_OP_END(op, n, elem_size) _flow_op_timed((op), _flow_op_t0, (n), (elem_size))
+#else
+#define _FLOW_TIMED_OP_BEGIN() (void)0
+#define _FLOW_TIMED_OP_END(op, n, elem_size) (void)0
+#endif
+#define _FLOW_OP_BEGIN(op, n, elem_size) \
+    _FLOW_USDT3(op_entry, (int)(op), (size_t)(n), (size_t)(elem_size)); _FLOW_TIMED_OP_BEGIN()
+#define _FLOW_OP_END(op, n, elem_size) \
+    _FLOW_TIMED_OP_END(op, n, elem_size); _FLOW_USDT3(op_exit, (int)(op), (size_t)(n), (size_t)(elem_size))
+
+// Internal: alignment of an arbitrary pointer, capped at FLOW_ALIGN.
+static inline size_t _flow_ptr_align(const void *p) {
+    uintptr_t a = (uintptr_t)p;
+    a &= -a;
+    return a == 0 || a > FLOW_ALIGN ? FLOW_ALIGN : (size_t)a;
+}
+
+// Internal: alignment of a view starting offset bytes into a buffer of the given alignment.
+static inline size_t _flow_view_align(size_t align, size_t offset) {
+    size_t a = align | offset;
+    return align ? (a & -a) : 0;
+}
+
+// Internal: run the body (expanded once) with _flow_aligned set to cond, for operator macros
+// whose body holds user code. Source pointers read through _FLOW_ALIGNED_SRC(p) are declared
+// FLOW_ALIGN-aligned when cond holds. This is only a hint: the loop keeps aligned loads when cond
+// folds to a constant (an operator's output feeding the next step), and uses plain loads otherwise.
+#define _FLOW_ALIGN_HINT(cond, ...) \
+    { const int _flow_aligned = (cond); __VA_ARGS__ }
+#define _FLOW_ALIGNED_SRC(p) (_flow_aligned ? (typeof(p))__builtin_assume_aligned((p), FLOW_ALIGN) : (p))
+
+// Internal: version a library loop on alignment. The body is emitted twice, with the constant
+// _flow_align set to FLOW_ALIGN when cond holds and to fallback otherwise, so each copy is compiled
+// for its own alignment. Reserved for kernels without user code, whose bodies are small.
+#define _FLOW_ALIGN_VERSIONED(cond, fallback, ...) \
+    if (cond) { enum { _flow_align = FLOW_ALIGN }; __VA_ARGS__ } \
+    else { enum { _flow_align = (fallback) }; __VA_ARGS__ }
+
+// Internal: dispatch name##N(...) on the number of arguments (1..12).
+#define _FLOW_NARGS(...) _FLOW_NARGS_(__VA_ARGS__, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define _FLOW_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, N, ...) N
+#define _FLOW_CAT(a, b) _FLOW_CAT_(a, b)
+#define _FLOW_CAT_(a, b) a##b
+#define _FLOW_OVERLOAD(name, ...) _FLOW_CAT(name, _FLOW_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
 /**
  * @brief Create an iterator from a static array.
  * @param arr The static array to convert.
  * @return An Iterator structure representing the array.
  */
 #define to_iter(arr) \
-    ((Iterator){ .data = (arr), .len = sizeof(arr)/sizeof(*(arr)), .elem_size = sizeof(*(arr)) })
+    ((Iterator){ .data = (arr), .len = sizeof(arr)/sizeof(*(arr)), .elem_size = sizeof(*(arr)), \
+                 .align = _flow_ptr_align(arr) })
 
 /**
  * @brief Map each element of an iterator to a new value.
+ * Typed form: iter_map(it, in_var, out_type, out_expr) infers in_type from a typed handle.
  * @param iter The input iterator.
  * @param in_type The type of each input element.
  * @param in_var The variable name for each input element.
  * @param out_type The type of each output element.
  * @param out_expr The expression to compute the output value.
- * @return Iterator of mapped values.
+ * @return Iterator of mapped values (Iterator_T in the typed form).
  */
-#define iter_map(iter, in_type, in_var, out_type, out_expr) \
+#define iter_map(...) _FLOW_OVERLOAD(_iter_map_, __VA_ARGS__)
+
+// Internal: explicitly typed form of iter_map.
+#define _iter_map_5(iter, in_type, in_var, out_type, out_expr) \
     ({ \
-        Iterator input = (iter); \
-        out_type *output = malloc(input.len * sizeof(out_type)); \
-        for (size_t index = 0; index < input.len; ++index) { \
-            in_type in_var = ((in_type*)input.data)[index]; \
-            output[index] = (out_expr); \
-        } \
-        (Iterator){ .data = output, .len = input.len, .elem_size = sizeof(out_type) }; \
+        Iterator input = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_MAP, input.len, input.elem_size); \
+        out_type *output = __builtin_assume_aligned(_flow_alloc(FLOW_OP_MAP, input.len * sizeof(out_type)), FLOW_ALIGN); \
+        _FLOW_ALIGN_HINT(input.align >= FLOW_ALIGN, \
+            in_type *_src = _FLOW_ALIGNED_SRC(input.data); \
+            for (size_t index = 0; index < input.len; ++index) { \
+                in_type in_var = _src[index]; \
+                output[index] = (out_expr); \
+            }) \
+        _FLOW_OP_END(FLOW_OP_MAP, input.len, input.elem_size); \
+        (Iterator){ .data = output, .len = input.len, .elem_size = sizeof(out_type), .align = FLOW_ALIGN }; \
     })
 
 /**
  * @brief Filter elements of an iterator by a predicate.
+ * Typed form: iter_filter(it, var, predicate) infers type from a typed handle.
  * @param iter The input iterator.
  * @param type The type of each element.
  * @param var The variable name for each element.
  * @param predicate The predicate expression (returns true to keep).
- * @return Iterator of filtered values.
+ * @return Iterator of filtered values (Iterator_T in the typed form).
  */
-#define iter_filter(iter, type, var, predicate) \
+#define iter_filter(...) _FLOW_OVERLOAD(_iter_filter_, __VA_ARGS__)
+
+// Internal: explicitly typed form of iter_filter.
+#define _iter_filter_4(iter, type, var, predicate) \
     ({ \
-        Iterator input = (iter); \
-        type *output = malloc(input.len * sizeof(type)); \
+        Iterator input = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_FILTER, input.len, input.elem_size); \
+        type *output = __builtin_assume_aligned(_flow_alloc(FLOW_OP_FILTER, input.len * sizeof(type)), FLOW_ALIGN); \
         size_t count = 0; \
-        for (size_t index = 0; index < input.len; ++index) { \
-            type var = ((type*)input.data)[index]; \
-            if (predicate) output[count++] = var; \
-        } \
-        (Iterator){ .data = output, .len = count, .elem_size = sizeof(type) }; \
+        _FLOW_ALIGN_HINT(input.align >= FLOW_ALIGN, \
+            type *_src = _FLOW_ALIGNED_SRC(input.data); \
+            for (size_t index = 0; index < input.len; ++index) { \
+                type var = _src[index]; \
+                if (predicate) output[count++] = var; \
+            }) \
+        _FLOW_OP_END(FLOW_OP_FILTER, input.len, input.elem_size); \
+        (Iterator){ .data = output, .len = count, .elem_size = sizeof(type), .align = FLOW_ALIGN }; \
     })
 
 /**
  * @brief Reduce (sum) all elements of an iterator.
+ * Typed form: iter_sum(it) dispatches to the vectorised iter_T_sum kernel.
  * @param iter The input iterator.
  * @param type The type of each element (must be numeric).
  * @return The sum of all elements.
  */
-#define iter_sum(iter, type) \
+#define iter_sum(...) _FLOW_OVERLOAD(_iter_sum_, __VA_ARGS__)
+
+// Internal: explicitly typed form of iter_sum.
+#define _iter_sum_2(iter, type) \
     ({ \
-        Iterator input = (iter); \
+        Iterator input = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_SUM, input.len, input.elem_size); \
         type sum = 0; \
-        for (size_t index = 0; index < input.len; ++index) sum += ((type*)input.data)[index]; \
+        _FLOW_ALIGN_HINT(input.align >= FLOW_ALIGN, \
+            type *_src = _FLOW_ALIGNED_SRC(input.data); \
+            for (size_t index = 0; index < input.len; ++index) sum += _src[index];) \
+        _FLOW_OP_END(FLOW_OP_SUM, input.len, input.elem_size); \
         sum; \
     })
 
 /**
  * @brief Apply an operation to each element of an iterator (side effects only).
+ * Typed form: iter_for(it, var, op) infers type from a typed handle.
  * @param iter The input iterator.
  * @param type The type of each element.
  * @param var The variable name for each element.
  * @param op The operation to perform (e.g., printf).
  * @return The original iterator (unchanged).
  */
-#define iter_for(iter, type, var, op) \
+#define iter_for(...) _FLOW_OVERLOAD(_iter_for_, __VA_ARGS__)
+
+// Internal: explicitly typed form of iter_for.
+#define _iter_for_4(iter, type, var, op) \
     ({ \
-        Iterator input = (iter); \
+        Iterator input = FLOW_ITER(iter); \
         for (size_t index = 0; index < input.len; ++index) { \
             type var = ((type*)input.data)[index]; \
             op; \
@@ -104,9 +1114,9 @@ typedef struct {
  */
 #define iter_take(iter, n) \
     ({ \
-        Iterator input = (iter); \
+        Iterator input = FLOW_ITER(iter); \
         size_t count = (n) < input.len ? (n) : input.len; \
-        (Iterator){ .data = input.data, .len = count, .elem_size = input.elem_size }; \
+        (Iterator){ .data = input.data, .len = count, .elem_size = input.elem_size, .align = input.align }; \
     })
 
 /**
@@ -117,9 +1127,10 @@ typedef struct {
  */
 #define iter_drop(iter, n) \
     ({ \
-        Iterator input = (iter); \
+        Iterator input = FLOW_ITER(iter); \
         size_t count = (n) < input.len ? (n) : input.len; \
-        (Iterator){ .data = (char*)input.data + count * input.elem_size, .len = input.len - count, .elem_size = input.elem_size }; \
+        (Iterator){ .data = (char*)input.data + count * input.elem_size, .len = input.len - count, .elem_size = input.elem_size, \
+                    .align = _flow_view_align(input.align, count * input.elem_size) }; \
     })
 
 /**
@@ -129,13 +1140,15 @@ typedef struct {
  */
 #define iter_reverse(iter) \
     ({ \
-        Iterator input = (iter); \
-        void* output = malloc(input.len * input.elem_size); \
+        Iterator input = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_REVERSE, input.len, input.elem_size); \
+        void* output = _flow_alloc(FLOW_OP_REVERSE, input.len * input.elem_size); \
         for (size_t index = 0; index < input.len; ++index) \
             memcpy((char*)output + index * input.elem_size, \
                    (char*)input.data + (input.len - 1 - index) * input.elem_size, \
                    input.elem_size); \
-        (Iterator){ .data = output, .len = input.len, .elem_size = input.elem_size }; \
+        _FLOW_OP_END(FLOW_OP_REVERSE, input.len, input.elem_size); \
+        (Iterator){ .data = output, .len = input.len, .elem_size = input.elem_size, .align = FLOW_ALIGN }; \
     })
 
 /**
@@ -145,8 +1158,9 @@ typedef struct {
  */
 #define iter_unique(iter) \
     ({ \
-        Iterator input = (iter); \
-        void* output = malloc(input.len * input.elem_size); \
+        Iterator input = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_UNIQUE, input.len, input.elem_size); \
+        void* output = _flow_alloc(FLOW_OP_UNIQUE, input.len * input.elem_size); \
         size_t count = 0; \
         for (size_t i = 0; i < input.len; ++i) { \
             int found = 0; \
@@ -155,7 +1169,8 @@ typedef struct {
             if (!found) \
                 memcpy((char*)output + count++ * input.elem_size, (char*)input.data + i * input.elem_size, input.elem_size); \
         } \
-        (Iterator){ .data = output, .len = count, .elem_size = input.elem_size }; \
+        _FLOW_OP_END(FLOW_OP_UNIQUE, input.len, input.elem_size); \
+        (Iterator){ .data = output, .len = count, .elem_size = input.elem_size, .align = FLOW_ALIGN }; \
     })
 
 /**
@@ -166,25 +1181,29 @@ typedef struct {
  */
 #define iter_concat(iter1, iter2) \
     ({ \
-        Iterator a = (iter1), b = (iter2); \
-        void* output = malloc((a.len + b.len) * a.elem_size); \
+        Iterator a = FLOW_ITER(iter1), b = FLOW_ITER(iter2); \
+        _FLOW_OP_BEGIN(FLOW_OP_CONCAT, a.len + b.len, a.elem_size); \
+        void* output = _flow_alloc(FLOW_OP_CONCAT, (a.len + b.len) * a.elem_size); \
         memcpy(output, a.data, a.len * a.elem_size); \
         memcpy((char*)output + a.len * a.elem_size, b.data, b.len * b.elem_size); \
-        (Iterator){ .data = output, .len = a.len + b.len, .elem_size = a.elem_size }; \
+        _FLOW_OP_END(FLOW_OP_CONCAT, a.len + b.len, a.elem_size); \
+        (Iterator){ .data = output, .len = a.len + b.len, .elem_size = a.elem_size, .align = FLOW_ALIGN }; \
     })
 
 // Internal, pointer-based version (do not use directly)
 #define _iter_pad_ptr(iter, newlen, padptr) \
     ({ \
-        Iterator _it = (iter); \
+        Iterator _it = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_PAD, _it.len, _it.elem_size); \
         size_t _n = (newlen); \
-        void* _out = malloc(_n * _it.elem_size); \
+        void* _out = _flow_alloc(FLOW_OP_PAD, _n * _it.elem_size); \
         size_t _i = 0; \
         for (; _i < _it.len && _i < _n; ++_i) \
             memcpy((char*)_out + _i * _it.elem_size, (char*)_it.data + _i * _it.elem_size, _it.elem_size); \
         for (; _i < _n; ++_i) \
             memcpy((char*)_out + _i * _it.elem_size, (padptr), _it.elem_size); \
-        (Iterator){ .data = _out, .len = _n, .elem_size = _it.elem_size }; \
+        _FLOW_OP_END(FLOW_OP_PAD, _it.len, _it.elem_size); \
+        (Iterator){ .data = _out, .len = _n, .elem_size = _it.elem_size, .align = FLOW_ALIGN }; \
     })
 
 /**
@@ -208,12 +1227,14 @@ typedef struct {
  */
 #define iter_repeat(iter, times) \
     ({ \
-        Iterator input = (iter); \
+        Iterator input = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_REPEAT, input.len, input.elem_size); \
         size_t repeat_count = (times); \
-        void* output = malloc(input.len * repeat_count * input.elem_size); \
+        void* output = _flow_alloc(FLOW_OP_REPEAT, input.len * repeat_count * input.elem_size); \
         for (size_t i = 0; i < repeat_count; ++i) \
             memcpy((char*)output + i * input.len * input.elem_size, input.data, input.len * input.elem_size); \
-        (Iterator){ .data = output, .len = input.len * repeat_count, .elem_size = input.elem_size }; \
+        _FLOW_OP_END(FLOW_OP_REPEAT, input.len, input.elem_size); \
+        (Iterator){ .data = output, .len = input.len * repeat_count, .elem_size = input.elem_size, .align = FLOW_ALIGN }; \
     })
 
 /**
@@ -229,15 +1250,67 @@ typedef struct {
  */
 #define iter_foldl(iter, type, acc_type, acc, in_var, init, expr) \
     ({ \
-        Iterator input = (iter); \
+        Iterator input = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_FOLDL, input.len, input.elem_size); \
         acc_type acc = (init); \
-        for (size_t index = 0; index < input.len; ++index) { \
-            type in_var = ((type*)input.data)[index]; \
-            acc = (expr); \
-        } \
+        _FLOW_ALIGN_HINT(input.align >= FLOW_ALIGN, \
+            type *_src = _FLOW_ALIGNED_SRC(input.data); \
+            for (size_t index = 0; index < input.len; ++index) { \
+                type in_var = _src[index]; \
+                acc = (expr); \
+            }) \
+        _FLOW_OP_END(FLOW_OP_FOLDL, input.len, input.elem_size); \
         acc; \
     })
 
+// Independent accumulators used by iter_reduce_assoc.
+#ifndef FLOW_REDUCE_LANES
+#define FLOW_REDUCE_LANES 8
+#endif
+
+/**
+ * @brief Fold with FLOW_REDUCE_LANES independent accumulators for associative, commutative updates.
+ * Breaks the single-accumulator dependency chain of iter_foldl so updates overlap in the pipeline.
+ * @param iter The input iterator.
+ * @param type The type of each element.
+ * @param acc_type The type of the accumulator.
+ * @param acc The accumulator variable.
+ * @param in_var The variable name for each input element (in combine: the other partial, of acc_type).
+ * @param init The identity of the operation (every lane starts from it).
+ * @param expr The expression to update the accumulator with one element.
+ * @param combine The expression merging two partials acc and in_var.
+ * @return The combined value of all lanes.
+ */
+#define iter_reduce_assoc(iter, type, acc_type, acc, in_var, init, expr, combine) \
+    ({ \
+        Iterator input = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_REDUCE, input.len, input.elem_size); \
+        acc_type _lanes[FLOW_REDUCE_LANES]; \
+        for (size_t _k = 0; _k < FLOW_REDUCE_LANES; ++_k) _lanes[_k] = (init); \
+        size_t index = 0; \
+        _FLOW_ALIGN_HINT(input.align >= FLOW_ALIGN, \
+            type *_src = _FLOW_ALIGNED_SRC(input.data); \
+            for (; index + FLOW_REDUCE_LANES <= input.len; index += FLOW_REDUCE_LANES) \
+                for (size_t _k = 0; _k < FLOW_REDUCE_LANES; ++_k) { \
+                    acc_type acc = _lanes[_k]; \
+                    type in_var = _src[index + _k]; \
+                    _lanes[_k] = (expr); \
+                } \
+            for (; index < input.len; ++index) { \
+                acc_type acc = _lanes[0]; \
+                type in_var = _src[index]; \
+                _lanes[0] = (expr); \
+            }) \
+        for (size_t _step = 1; _step < FLOW_REDUCE_LANES; _step *= 2) \
+            for (size_t _k = 0; _k + _step < FLOW_REDUCE_LANES; _k += 2 * _step) { \
+                acc_type acc = _lanes[_k]; \
+                acc_type in_var = _lanes[_k + _step]; \
+                _lanes[_k] = (combine); \
+            } \
+        _FLOW_OP_END(FLOW_OP_REDUCE, input.len, input.elem_size); \
+        _lanes[0]; \
+    })
+
 /**
  * @brief Right fold (accumulate from right to left).
  * @param iter The input iterator.
@@ -251,12 +1324,14 @@ typedef struct {
  */
 #define iter_foldr(iter, type, acc_type, acc, in_var, init, expr) \
     ({ \
-        Iterator input = (iter); \
+        Iterator input = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_FOLDR, input.len, input.elem_size); \
         acc_type acc = (init); \
         for (ptrdiff_t index = (ptrdiff_t)input.len - 1; index >= 0; --index) { \
             type in_var = ((type*)input.data)[index]; \
             acc = (expr); \
         } \
+        _FLOW_OP_END(FLOW_OP_FOLDR, input.len, input.elem_size); \
         acc; \
     })
     
@@ -271,13 +1346,15 @@ typedef struct {
  */
 #define iter_zip(it1type, it1, it2type, it2, pairtype) \
     ({ \
-        Iterator _a = (it1), _b = (it2); \
+        Iterator _a = FLOW_ITER(it1), _b = FLOW_ITER(it2); \
         size_t _n = _a.len < _b.len ? _a.len : _b.len; \
-        pairtype* _out = malloc(_n * sizeof(pairtype)); \
+        _FLOW_OP_BEGIN(FLOW_OP_ZIP, _n, _a.elem_size + _b.elem_size); \
+        pairtype* _out = _flow_alloc(FLOW_OP_ZIP, _n * sizeof(pairtype)); \
         for (size_t _i = 0; _i < _n; ++_i) { \
             _out[_i] = (pairtype){ .a = ((it1type*)_a.data)[_i], .b = ((it2type*)_b.data)[_i] }; \
         } \
-        (Iterator){ .data = _out, .len = _n, .elem_size = sizeof(pairtype) }; \
+        _FLOW_OP_END(FLOW_OP_ZIP, _n, _a.elem_size + _b.elem_size); \
+        (Iterator){ .data = _out, .len = _n, .elem_size = sizeof(pairtype), .align = FLOW_ALIGN }; \
     })
 
 /**
@@ -289,20 +1366,22 @@ typedef struct {
  */
 #define iter_flatten(iter, itertype, elemtype) \
     ({ \
-        Iterator input = (iter); \
+        Iterator input = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_FLATTEN, input.len, input.elem_size); \
         size_t total = 0; \
         for (size_t i = 0; i < input.len; ++i) { \
             itertype inner = ((itertype*)input.data)[i]; \
             total += inner.len; \
         } \
-        elemtype* output = malloc(total * sizeof(elemtype)); \
+        elemtype* output = _flow_alloc(FLOW_OP_FLATTEN, total * sizeof(elemtype)); \
         size_t pos = 0; \
         for (size_t i = 0; i < input.len; ++i) { \
             itertype inner = ((itertype*)input.data)[i]; \
             for (size_t j = 0; j < inner.len; ++j) \
                 output[pos++] = ((elemtype*)inner.data)[j]; \
         } \
-        (Iterator){ .data = output, .len = total, .elem_size = sizeof(elemtype) }; \
+        _FLOW_OP_END(FLOW_OP_FLATTEN, total, sizeof(elemtype)); \
+        (Iterator){ .data = output, .len = total, .elem_size = sizeof(elemtype), .align = FLOW_ALIGN }; \
     })
 
 /**
@@ -316,18 +1395,20 @@ typedef struct {
 typedef struct { Iterator yes, no; } IteratorPartitionResult;
 #define iter_partition(iter, type, var, predicate) \
     ({ \
-        Iterator input = (iter); \
-        type* yes_output = malloc(input.len * sizeof(type)); \
-        type* no_output = malloc(input.len * sizeof(type)); \
+        Iterator input = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_PARTITION, input.len, input.elem_size); \
+        type* yes_output = _flow_alloc(FLOW_OP_PARTITION, input.len * sizeof(type)); \
+        type* no_output = _flow_alloc(FLOW_OP_PARTITION, input.len * sizeof(type)); \
         size_t yes_count = 0, no_count = 0; \
         for (size_t index = 0; index < input.len; ++index) { \
             type var = ((type*)input.data)[index]; \
             if (predicate) yes_output[yes_count++] = var; \
             else no_output[no_count++] = var; \
         } \
+        _FLOW_OP_END(FLOW_OP_PARTITION, input.len, input.elem_size); \
         (IteratorPartitionResult){ \
-            .yes = (Iterator){ .data = yes_output, .len = yes_count, .elem_size = sizeof(type) }, \
-            .no = (Iterator){ .data = no_output, .len = no_count, .elem_size = sizeof(type) } \
+            .yes = (Iterator){ .data = yes_output, .len = yes_count, .elem_size = sizeof(type), .align = FLOW_ALIGN }, \
+            .no = (Iterator){ .data = no_output, .len = no_count, .elem_size = sizeof(type), .align = FLOW_ALIGN } \
         }; \
     })
 
@@ -342,15 +1423,19 @@ typedef struct { Iterator yes, no; } IteratorPartitionResult;
  */
 #define iter_scan(iter, type, var, init, expr) \
     ({ \
-        Iterator input = (iter); \
+        Iterator input = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_SCAN, input.len, input.elem_size); \
         type acc = (init); \
-        type* output = malloc(input.len * sizeof(type)); \
-        for (size_t index = 0; index < input.len; ++index) { \
-            type var = ((type*)input.data)[index]; \
-            acc = (expr); \
-            output[index] = acc; \
-        } \
-        (Iterator){ .data = output, .len = input.len, .elem_size = sizeof(type) }; \
+        type* output = __builtin_assume_aligned(_flow_alloc(FLOW_OP_SCAN, input.len * sizeof(type)), FLOW_ALIGN); \
+        _FLOW_ALIGN_HINT(input.align >= FLOW_ALIGN, \
+            type *_src = _FLOW_ALIGNED_SRC(input.data); \
+            for (size_t index = 0; index < input.len; ++index) { \
+                type var = _src[index]; \
+                acc = (expr); \
+                output[index] = acc; \
+            }) \
+        _FLOW_OP_END(FLOW_OP_SCAN, input.len, input.elem_size); \
+        (Iterator){ .data = output, .len = input.len, .elem_size = sizeof(type), .align = FLOW_ALIGN }; \
     })
 
 /**
@@ -363,12 +1448,14 @@ typedef struct { Iterator yes, no; } IteratorPartitionResult;
  */
 #define iter_any(iter, type, var, predicate) \
     ({ \
-        Iterator input = (iter); \
+        Iterator input = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_ANY, input.len, input.elem_size); \
         int found = 0; \
         for (size_t index = 0; index < input.len; ++index) { \
             type var = ((type*)input.data)[index]; \
             if (predicate) { found = 1; break; } \
         } \
+        _FLOW_OP_END(FLOW_OP_ANY, input.len, input.elem_size); \
         found; \
     })
 
@@ -382,12 +1469,14 @@ typedef struct { Iterator yes, no; } IteratorPartitionResult;
  */
 #define iter_all(iter, type, var, predicate) \
     ({ \
-        Iterator input = (iter); \
+        Iterator input = FLOW_ITER(iter); \
+        _FLOW_OP_BEGIN(FLOW_OP_ALL, input.len, input.elem_size); \
         int all = 1; \
         for (size_t index = 0; index < input.len; ++index) { \
             type var = ((type*)input.data)[index]; \
             if (!(predicate)) { all = 0; break; } \
         } \
+        _FLOW_OP_END(FLOW_OP_ALL, input.len, input.elem_size); \
         all; \
     })
 
@@ -402,9 +1491,11 @@ typedef struct { Iterator yes, no; } IteratorPartitionResult;
     ({ \
         type _s = (start), _e = (end); \
         size_t count = (_e > _s) ? (_e - _s) : 0; \
-        type* output = malloc(count * sizeof(type)); \
+        _FLOW_OP_BEGIN(FLOW_OP_RANGE, count, sizeof(type)); \
+        type* output = _flow_alloc(FLOW_OP_RANGE, count * sizeof(type)); \
         for (size_t index = 0; index < count; ++index) output[index] = _s + (type)index; \
-        (Iterator){ .data = output, .len = count, .elem_size = sizeof(type) }; \
+        _FLOW_OP_END(FLOW_OP_RANGE, count, sizeof(type)); \
+        (Iterator){ .data = output, .len = count, .elem_size = sizeof(type), .align = FLOW_ALIGN }; \
     })
 
 /**
@@ -416,57 +1507,2213 @@ typedef struct { Iterator yes, no; } IteratorPartitionResult;
  */
 #define iter_slice(iter, start, end) \
     ({ \
-        Iterator input = (iter); \
+        Iterator input = FLOW_ITER(iter); \
         size_t s = (start) < input.len ? (start) : input.len; \
         size_t e = (end) < input.len ? (end) : input.len; \
-        (Iterator){ .data = (char*)input.data + s * input.elem_size, .len = (e > s ? e - s : 0), .elem_size = input.elem_size }; \
+        (Iterator){ .data = (char*)input.data + s * input.elem_size, .len = (e > s ? e - s : 0), .elem_size = input.elem_size, \
+                    .align = _flow_view_align(input.align, s * input.elem_size) }; \
     })
 
-// Pipe macros (as before)
-#define PIPE_STEP_1(init, s1) \
-    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER; })
-#define PIPE_STEP_2(init, s1, s2) \
-    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER; })
-#define PIPE_STEP_3(init, s1, s2, s3) \
-    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER; })
-#define PIPE_STEP_4(init, s1, s2, s3, s4) \
-    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER = (s4); PIPE_PLACEHOLDER; })
-#define PIPE_STEP_5(init, s1, s2, s3, s4, s5) \
-    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER = (s4); PIPE_PLACEHOLDER = (s5); PIPE_PLACEHOLDER; })
-#define PIPE_STEP_6(init, s1, s2, s3, s4, s5, s6) \
-    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER = (s4); PIPE_PLACEHOLDER = (s5); PIPE_PLACEHOLDER = (s6); PIPE_PLACEHOLDER; })
-#define PIPE_STEP_7(init, s1, s2, s3, s4, s5, s6, s7) \
-    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER = (s4); PIPE_PLACEHOLDER = (s5); PIPE_PLACEHOLDER = (s6); PIPE_PLACEHOLDER = (s7); PIPE_PLACEHOLDER; })
-#define PIPE_STEP_8(init, s1, s2, s3, s4, s5, s6, s7, s8) \
-    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER = (s4); PIPE_PLACEHOLDER = (s5); PIPE_PLACEHOLDER = (s6); PIPE_PLACEHOLDER = (s7); PIPE_PLACEHOLDER = (s8); PIPE_PLACEHOLDER; })
-#define PIPE_STEP_9(init, s1, s2, s3, s4, s5, s6, s7, s8, s9) \
-    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER = (s4); PIPE_PLACEHOLDER = (s5); PIPE_PLACEHOLDER = (s6); PIPE_PLACEHOLDER = (s7); PIPE_PLACEHOLDER = (s8); PIPE_PLACEHOLDER = (s9); PIPE_PLACEHOLDER; })
-#define PIPE_STEP_10(init, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10) \
-    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER = (s4); PIPE_PLACEHOLDER = (s5); PIPE_PLACEHOLDER = (s6); PIPE_PLACEHOLDER = (s7); PIPE_PLACEHOLDER = (s8); PIPE_PLACEHOLDER = (s9); PIPE_PLACEHOLDER = (s10); PIPE_PLACEHOLDER; })
+// In-place operators: each writes its result into the input's buffer and returns an Iterator over
+// it that takes over the input's ownership, so use the result instead of the input afterwards.
+// Free the result exactly when the input would have needed freeing:
+// - an owning handle of a flow.h buffer (an operator output, shared or not): iter_free the result.
+//   If the buffer is shared, the handle's reference is swapped for a private copy first;
+// - a user array (to_iter) or a view (iter_take, iter_slice, ...) of an unshared buffer: the
+//   result points into that memory and must not be freed; free the original owner as before;
+// - a view into a buffer shared with iter_share aborts, as in iter_make_unique.
 
-#define GET_PIPE_MACRO(_1,_2,_3,_4,_5,_6,_7,_8,_9,_10,_11,NAME,...) NAME
+// Internal: reverse n elements of size bytes each at p.
+static inline void _flow_reverse_elems(char *p, size_t n, size_t size) {
+    if (n < 2) return;
+    for (char *a = p, *b = p + (n - 1) * size; a < b; a += size, b -= size)
+        for (size_t k = 0; k < size; ++k) {
+            char t = a[k];
+            a[k] = b[k];
+            b[k] = t;
+        }
+}
 
-#define pipe(...) \
-    GET_PIPE_MACRO(__VA_ARGS__, \
-        PIPE_STEP_10, PIPE_STEP_9, PIPE_STEP_8, PIPE_STEP_7, PIPE_STEP_6, \
-        PIPE_STEP_5, PIPE_STEP_4, PIPE_STEP_3, PIPE_STEP_2, PIPE_STEP_1)(__VA_ARGS__)
+// Internal: swap the adjacent runs [p, p + left) and [p + left, p + left + right) (in elements).
+static inline void _flow_rotate_elems(char *p, size_t left, size_t right, size_t size) {
+    if (!left || !right) return;
+    _flow_reverse_elems(p, left, size);
+    _flow_reverse_elems(p + left * size, right, size);
+    _flow_reverse_elems(p, left + right, size);
+}
 
-// chain: direct unary function nesting, no placeholder support
-#define CHAIN_2(input, f1)           f1(input)
-#define CHAIN_3(input, f1, f2)       f2(f1(input))
-#define CHAIN_4(input, f1, f2, f3, f4)   f4(f3(f2(f1(input))))
-#define CHAIN_5(input, f1, f2, f3, f4) f4(f3(f2(f1(input))))
-#define CHAIN_6(input, f1, f2, f3, f4, f5) f5(f4(f3(f2(f1(input)))))
-#define CHAIN_7(input, f1, f2, f3, f4, f5, f6) f6(f5(f4(f3(f2(f1(input))))))
-#define CHAIN_8(input, f1, f2, f3, f4, f5, f6, f7) f7(f6(f5(f4(f3(f2(f1(input)))))))
-#define CHAIN_9(input, f1, f2, f3, f4, f5, f6, f7, f8) f8(f7(f6(f5(f4(f3(f2(f1(input))))))))
-#define CHAIN_10(input, f1, f2, f3, f4, f5, f6, f7, f8, f9) f9(f8(f7(f6(f5(f4(f3(f2(f1(input)))))))))
+// Internal: first index in [lo, hi) of the partitioned run d[lo..hi) whose element fails predicate.
+#define _FLOW_PARTITION_POINT(d, lo, hi, type, var, predicate) \
+    ({ \
+        size_t _pl = (lo), _ph = (hi); \
+        while (_pl < _ph) { \
+            size_t _pm = _pl + (_ph - _pl) / 2; \
+            type var = (d)[_pm]; \
+            if (predicate) _pl = _pm + 1; \
+            else _ph = _pm; \
+        } \
+        _pl; \
+    })
 
-#define GET_CHAIN_MACRO(_1,_2,_3,_4,_5,_6,_7,_8,_9,_10,_11,NAME,...) NAME
-#define chain(...) \
-    GET_CHAIN_MACRO(__VA_ARGS__, \
-        CHAIN_10, CHAIN_9, CHAIN_8, CHAIN_7, CHAIN_6, \
-        CHAIN_5, CHAIN_4, CHAIN_3, CHAIN_2)(__VA_ARGS__)
+/**
+ * @brief Map in place; out_type must have the same size as in_type.
+ * @param iter The input iterator (consumed; the result takes over its ownership, see above).
+ * @param in_type The type of each input element.
+ * @param in_var The variable name for each input element.
+ * @param out_type The type of each output element (sizeof(out_type) == sizeof(in_type)).
+ * @param out_expr The expression to compute the output value.
+ * @return Iterator of mapped values, in the input's buffer.
+ */
+#define iter_map_inplace(iter, in_type, in_var, out_type, out_expr) \
+    ({ \
+        _Static_assert(sizeof(in_type) == sizeof(out_type), "iter_map_inplace needs same-size types"); \
+        Iterator input = iter_make_unique(FLOW_ITER(iter)); \
+        _FLOW_OP_BEGIN(FLOW_OP_MAP, input.len, input.elem_size); \
+        for (size_t index = 0; index < input.len; ++index) { \
+            in_type in_var = ((in_type*)input.data)[index]; \
+            ((out_type*)input.data)[index] = (out_expr); \
+        } \
+        _FLOW_OP_END(FLOW_OP_MAP, input.len, input.elem_size); \
+        (Iterator){ .data = input.data, .len = input.len, .elem_size = sizeof(out_type), .align = input.align }; \
+    })
+
+/**
+ * @brief Keep the elements matching predicate, compacting them to the front in order.
+ * @param iter The input iterator (consumed; the result takes over its ownership, see above).
+ * @param type The type of each element.
+ * @param var The variable name for each element.
+ * @param predicate The predicate expression (returns true to keep).
+ * @return Iterator of the kept elements, in the input's buffer.
+ */
+#define iter_filter_inplace(iter, type, var, predicate) \
+    ({ \
+        Iterator input = iter_make_unique(FLOW_ITER(iter)); \
+        _FLOW_OP_BEGIN(FLOW_OP_FILTER, input.len, input.elem_size); \
+        type *_d = (type*)input.data; \
+        size_t count = 0; \
+        for (size_t index = 0; index < input.len; ++index) { \
+            type var = _d[index]; \
+            if (predicate) _d[count++] = var; \
+        } \
+        _FLOW_OP_END(FLOW_OP_FILTER, input.len, input.elem_size); \
+        (Iterator){ .data = input.data, .len = count, .elem_size = input.elem_size, .align = input.align }; \
+    })
+
+/**
+ * @brief Reverse the elements in place by swapping from both ends.
+ * @param iter The input iterator (consumed; the result takes over its ownership, see above).
+ * @return Iterator with elements in reverse order, in the input's buffer.
+ */
+#define iter_reverse_inplace(iter) \
+    ({ \
+        Iterator input = iter_make_unique(FLOW_ITER(iter)); \
+        _FLOW_OP_BEGIN(FLOW_OP_REVERSE, input.len, input.elem_size); \
+        _flow_reverse_elems((char*)input.data, input.len, input.elem_size); \
+        _FLOW_OP_END(FLOW_OP_REVERSE, input.len, input.elem_size); \
+        input; \
+    })
+
+/**
+ * @brief Prefix scan in place: element i becomes the accumulator after elements 0..i.
+ * @param iter The input iterator (consumed; the result takes over its ownership, see above).
+ * @param type The type of each element.
+ * @param var The variable name for each element.
+ * @param init The initial value.
+ * @param expr The expression to update the value (acc is the running accumulator).
+ * @return Iterator of scanned values, in the input's buffer.
+ */
+#define iter_scan_inplace(iter, type, var, init, expr) \
+    ({ \
+        Iterator input = iter_make_unique(FLOW_ITER(iter)); \
+        _FLOW_OP_BEGIN(FLOW_OP_SCAN, input.len, input.elem_size); \
+        type *_d = (type*)input.data; \
+        type acc = (init); \
+        for (size_t index = 0; index < input.len; ++index) { \
+            type var = _d[index]; \
+            acc = (expr); \
+            _d[index] = acc; \
+        } \
+        _FLOW_OP_END(FLOW_OP_SCAN, input.len, input.elem_size); \
+        input; \
+    })
+
+/**
+ * @brief Keep the first occurrence of each distinct element (bytewise), compacted in order.
+ * @param iter The input iterator (consumed; the result takes over its ownership, see above).
+ * @return Iterator of unique elements, in the input's buffer.
+ */
+#define iter_unique_inplace(iter) \
+    ({ \
+        Iterator input = iter_make_unique(FLOW_ITER(iter)); \
+        _FLOW_OP_BEGIN(FLOW_OP_UNIQUE, input.len, input.elem_size); \
+        char *_d = (char*)input.data; \
+        size_t _sz = input.elem_size, count = 0; \
+        for (size_t i = 0; i < input.len; ++i) { \
+            size_t j = 0; \
+            while (j < count && memcmp(_d + i * _sz, _d + j * _sz, _sz)) ++j; \
+            if (j == count) { \
+                if (count != i) memcpy(_d + count * _sz, _d + i * _sz, _sz); \
+                ++count; \
+            } \
+        } \
+        _FLOW_OP_END(FLOW_OP_UNIQUE, input.len, input.elem_size); \
+        (Iterator){ .data = input.data, .len = count, .elem_size = input.elem_size, .align = input.align }; \
+    })
+
+/**
+ * @brief Partition in place (unstable): matching elements move to the front by swapping.
+ * .yes and .no are views of one buffer; if the input was an owning handle, release it once,
+ * with iter_free(result.yes).
+ * @param iter The input iterator (consumed; the result takes over its ownership, see above).
+ * @param type The type of each element.
+ * @param var The variable name for each element.
+ * @param predicate The predicate expression (returns true for the yes part).
+ * @return Struct containing .yes (prefix) and .no (suffix) views.
+ */
+#define iter_partition_inplace(iter, type, var, predicate) \
+    ({ \
+        Iterator input = iter_make_unique(FLOW_ITER(iter)); \
+        _FLOW_OP_BEGIN(FLOW_OP_PARTITION, input.len, input.elem_size); \
+        type *_d = (type*)input.data; \
+        size_t _lo = 0, _hi = input.len; \
+        for (;;) { \
+            while (_lo < _hi) { type var = _d[_lo]; if (!(predicate)) break; ++_lo; } \
+            while (_lo < _hi) { type var = _d[_hi - 1]; if (predicate) break; --_hi; } \
+            if (_lo >= _hi) break; \
+            type _t = _d[_lo]; _d[_lo++] = _d[--_hi]; _d[_hi] = _t; \
+        } \
+        _FLOW_OP_END(FLOW_OP_PARTITION, input.len, input.elem_size); \
+        (IteratorPartitionResult){ \
+            .yes = (Iterator){ .data = _d, .len = _lo, .elem_size = sizeof(type), .align = input.align }, \
+            .no = (Iterator){ .data = _d + _lo, .len = input.len - _lo, .elem_size = sizeof(type), \
+                              .align = _flow_view_align(input.align, _lo * sizeof(type)) } \
+        }; \
+    })
+
+/**
+ * @brief Partition in place keeping the relative order of both parts, in O(n log n) moves
+ * (bottom-up merging of partitioned runs by rotation). predicate must be pure: it is evaluated
+ * O(log n) times per element. If the input was an owning handle, release the buffer once, with
+ * iter_free(result.yes).
+ * @param iter The input iterator (consumed; the result takes over its ownership, see above).
+ * @param type The type of each element.
+ * @param var The variable name for each element.
+ * @param predicate The predicate expression (returns true for the yes part).
+ * @return Struct containing .yes (prefix) and .no (suffix) views.
+ */
+#define iter_stable_partition_inplace(iter, type, var, predicate) \
+    ({ \
+        Iterator input = iter_make_unique(FLOW_ITER(iter)); \
+        _FLOW_OP_BEGIN(FLOW_OP_PARTITION, input.len, input.elem_size); \
+        type *_d = (type*)input.data; \
+        size_t _n = input.len; \
+        for (size_t _w = 1; _w < _n; _w *= 2) \
+            for (size_t _lo = 0; _lo + _w < _n; _lo += 2 * _w) { \
+                size_t _mid = _lo + _w, _hi = _mid + _w < _n ? _mid + _w : _n; \
+                size_t _a = _FLOW_PARTITION_POINT(_d, _lo, _mid, type, var, predicate); \
+                size_t _b = _FLOW_PARTITION_POINT(_d, _mid, _hi, type, var, predicate); \
+                _flow_rotate_elems((char*)(_d + _a), _mid - _a, _b - _mid, sizeof(type)); \
+            } \
+        size_t _yes = _FLOW_PARTITION_POINT(_d, 0, _n, type, var, predicate); \
+        _FLOW_OP_END(FLOW_OP_PARTITION, input.len, input.elem_size); \
+        (IteratorPartitionResult){ \
+            .yes = (Iterator){ .data = _d, .len = _yes, .elem_size = sizeof(type), .align = input.align }, \
+            .no = (Iterator){ .data = _d + _yes, .len = _n - _yes, .elem_size = sizeof(type), \
+                              .align = _flow_view_align(input.align, _yes * sizeof(type)) } \
+        }; \
+    })
+
+// Typed iterators: FLOW_DEFINE_ITER(T) emits Iterator_T (same layout as Iterator, typed data)
+// and static inline kernels over restrict-qualified, alignment-asserted pointers, so the
+// compiler can vectorise without alias checks. Inputs whose .align is at least FLOW_ALIGN
+// get a loop specialised for aligned loads.
+#define _FLOW_ASSUME_ALIGNED(T, ptr, align) \
+    ((T*)__builtin_assume_aligned((assert((uintptr_t)(ptr) % (align) == 0), (ptr)), (align)))
+
+/**
+ * @brief Define Iterator_T and its typed kernels for a single-token type (int, double, uint32_t, ...).
+ * @param T The element type.
+ */
+#define FLOW_DEFINE_ITER(T) FLOW_DEFINE_ITER_NAMED(T, T)
+
+/**
+ * @brief Define Iterator_name and its typed kernels for any type (e.g. unsigned long as ulong).
+ * @param T The element type.
+ * @param name The suffix used in Iterator_name and iter_name_* functions.
+ */
+#define FLOW_DEFINE_ITER_NAMED(T, name) \
+    typedef struct { _FLOW_ITER_FIELDS(T) } Iterator_##name; \
+    static inline Iterator_##name iter_##name##_from(Iterator it) { \
+        assert(it.len == 0 || it.elem_size == sizeof(T)); \
+        Iterator_##name out; \
+        memcpy(&out, &it, sizeof out); \
+        return out; \
+    } \
+    static inline Iterator iter_##name##_erase(Iterator_##name t) { \
+        Iterator out; \
+        memcpy(&out, &t, sizeof out); \
+        return out; \
+    } \
+    static inline Iterator_##name iter_##name##_alloc(size_t n) { \
+        return (Iterator_##name){ .data = _flow_alloc(FLOW_OP_TYPED, n * sizeof(T)), .len = n, .elem_size = sizeof(T), .align = FLOW_ALIGN }; \
+    } \
+    static inline T iter_##name##_sum(Iterator_##name t) { \
+        T acc[8] = {0}; \
+        _FLOW_ALIGN_VERSIONED(t.align >= FLOW_ALIGN, _Alignof(T), \
+            const T *restrict in = _FLOW_ASSUME_ALIGNED(T, t.data, _flow_align); \
+            size_t i = 0; \
+            for (; i + 8 <= t.len; i += 8) \
+                for (size_t j = 0; j < 8; ++j) acc[j] += in[i + j]; \
+            for (; i < t.len; ++i) acc[0] += in[i];) \
+        return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7])); \
+    } \
+    static inline T iter_##name##_dot(Iterator_##name a, Iterator_##name b) { \
+        size_t n = a.len < b.len ? a.len : b.len; \
+        T acc[8] = {0}; \
+        _FLOW_ALIGN_VERSIONED(a.align >= FLOW_ALIGN && b.align >= FLOW_ALIGN, _Alignof(T), \
+            const T *restrict x = _FLOW_ASSUME_ALIGNED(T, a.data, _flow_align); \
+            const T *restrict y = _FLOW_ASSUME_ALIGNED(T, b.data, _flow_align); \
+            size_t i = 0; \
+            for (; i + 8 <= n; i += 8) \
+                for (size_t j = 0; j < 8; ++j) acc[j] += x[i + j] * y[i + j]; \
+            for (; i < n; ++i) acc[0] += x[i] * y[i];) \
+        return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7])); \
+    } \
+    static inline T iter_##name##_min(Iterator_##name t) { \
+        assert(t.len > 0); \
+        const T *restrict in = _FLOW_ASSUME_ALIGNED(T, t.data, _Alignof(T)); \
+        T m = in[0]; \
+        for (size_t i = 1; i < t.len; ++i) m = in[i] < m ? in[i] : m; \
+        return m; \
+    } \
+    static inline T iter_##name##_max(Iterator_##name t) { \
+        assert(t.len > 0); \
+        const T *restrict in = _FLOW_ASSUME_ALIGNED(T, t.data, _Alignof(T)); \
+        T m = in[0]; \
+        for (size_t i = 1; i < t.len; ++i) m = in[i] > m ? in[i] : m; \
+        return m; \
+    } \
+    static inline Iterator_##name iter_##name##_map(Iterator_##name t, T (*f)(T)) { \
+        Iterator_##name o = iter_##name##_alloc(t.len); \
+        T *restrict out = _FLOW_ASSUME_ALIGNED(T, o.data, FLOW_ALIGN); \
+        _FLOW_ALIGN_VERSIONED(t.align >= FLOW_ALIGN, _Alignof(T), \
+            const T *restrict in = _FLOW_ASSUME_ALIGNED(T, t.data, _flow_align); \
+            for (size_t i = 0; i < t.len; ++i) out[i] = f(in[i]);) \
+        return o; \
+    } \
+    static inline Iterator_##name iter_##name##_scale(Iterator_##name t, T k) { \
+        Iterator_##name o = iter_##name##_alloc(t.len); \
+        T *restrict out = _FLOW_ASSUME_ALIGNED(T, o.data, FLOW_ALIGN); \
+        _FLOW_ALIGN_VERSIONED(t.align >= FLOW_ALIGN, _Alignof(T), \
+            const T *restrict in = _FLOW_ASSUME_ALIGNED(T, t.data, _flow_align); \
+            for (size_t i = 0; i < t.len; ++i) out[i] = in[i] * k;) \
+        return o; \
+    } \
+    static inline Iterator_##name iter_##name##_add(Iterator_##name a, Iterator_##name b) { \
+        size_t n = a.len < b.len ? a.len : b.len; \
+        Iterator_##name o = iter_##name##_alloc(n); \
+        T *restrict out = _FLOW_ASSUME_ALIGNED(T, o.data, FLOW_ALIGN); \
+        _FLOW_ALIGN_VERSIONED(a.align >= FLOW_ALIGN && b.align >= FLOW_ALIGN, _Alignof(T), \
+            const T *restrict x = _FLOW_ASSUME_ALIGNED(T, a.data, _flow_align); \
+            const T *restrict y = _FLOW_ASSUME_ALIGNED(T, b.data, _flow_align); \
+            for (size_t i = 0; i < n; ++i) out[i] = x[i] + y[i];) \
+        return o; \
+    } \
+    static inline Iterator_##name iter_##name##_mul(Iterator_##name a, Iterator_##name b) { \
+        size_t n = a.len < b.len ? a.len : b.len; \
+        Iterator_##name o = iter_##name##_alloc(n); \
+        T *restrict out = _FLOW_ASSUME_ALIGNED(T, o.data, FLOW_ALIGN); \
+        _FLOW_ALIGN_VERSIONED(a.align >= FLOW_ALIGN && b.align >= FLOW_ALIGN, _Alignof(T), \
+            const T *restrict x = _FLOW_ASSUME_ALIGNED(T, a.data, _flow_align); \
+            const T *restrict y = _FLOW_ASSUME_ALIGNED(T, b.data, _flow_align); \
+            for (size_t i = 0; i < n; ++i) out[i] = x[i] * y[i];) \
+        return o; \
+    } \
+    static inline Iterator_##name iter_##name##_filter(Iterator_##name t, int (*pred)(T)) { \
+        Iterator_##name o = iter_##name##_alloc(t.len); \
+        T *restrict out = _FLOW_ASSUME_ALIGNED(T, o.data, FLOW_ALIGN); \
+        const T *restrict in = _FLOW_ASSUME_ALIGNED(T, t.data, _Alignof(T)); \
+        size_t count = 0; \
+        for (size_t i = 0; i < t.len; ++i) { out[count] = in[i]; count += pred(in[i]) != 0; } \
+        o.len = count; \
+        return o; \
+    } \
+    static inline Iterator_##name iter_##name##_scan(Iterator_##name t) { \
+        Iterator_##name o = iter_##name##_alloc(t.len); \
+        T *restrict out = _FLOW_ASSUME_ALIGNED(T, o.data, FLOW_ALIGN); \
+        const T *restrict in = _FLOW_ASSUME_ALIGNED(T, t.data, _Alignof(T)); \
+        T acc = 0; \
+        for (size_t i = 0; i < t.len; ++i) out[i] = acc += in[i]; \
+        return o; \
+    } \
+    static inline Iterator_##name iter_##name##_reverse(Iterator_##name t) { \
+        Iterator_##name o = iter_##name##_alloc(t.len); \
+        T *restrict out = _FLOW_ASSUME_ALIGNED(T, o.data, FLOW_ALIGN); \
+        const T *restrict in = _FLOW_ASSUME_ALIGNED(T, t.data, _Alignof(T)); \
+        for (size_t i = 0; i < t.len; ++i) out[i] = in[t.len - 1 - i]; \
+        return o; \
+    }
+
+// Type inference: the predefined Iterator_T handles below carry their element type, so
+// _Generic picks the typed kernel and map/filter/for/sum can drop their type arguments.
+// Plain Iterators keep working everywhere; FLOW_ITER() erases a typed handle.
+#ifndef __cplusplus
+FLOW_DEFINE_ITER_NAMED(char, char)
+FLOW_DEFINE_ITER_NAMED(signed char, schar)
+FLOW_DEFINE_ITER_NAMED(unsigned char, uchar)
+FLOW_DEFINE_ITER_NAMED(short, short)
+FLOW_DEFINE_ITER_NAMED(unsigned short, ushort)
+FLOW_DEFINE_ITER_NAMED(int, int)
+FLOW_DEFINE_ITER_NAMED(unsigned int, uint)
+FLOW_DEFINE_ITER_NAMED(long, long)
+FLOW_DEFINE_ITER_NAMED(unsigned long, ulong)
+FLOW_DEFINE_ITER_NAMED(long long, llong)
+FLOW_DEFINE_ITER_NAMED(unsigned long long, ullong)
+FLOW_DEFINE_ITER_NAMED(float, float)
+FLOW_DEFINE_ITER_NAMED(double, double)
+
+// Internal: identity conversion used as the _Generic default.
+static inline Iterator _flow_iter_id(Iterator it) { return it; }
+
+// Internal: never defined; the _Generic default of the typed-only reductions, so a plain Iterator
+// fails to compile with the operator's name in the message.
+double _flow_iter_dot_needs_typed_iterator(Iterator, ...) __attribute__((error("iter_dot needs a typed iterator")));
+double _flow_iter_min_needs_typed_iterator(Iterator) __attribute__((error("iter_min needs a typed iterator")));
+double _flow_iter_max_needs_typed_iterator(Iterator) __attribute__((error("iter_max needs a typed iterator")));
+double _flow_iter_sum_needs_typed_iterator(Iterator) __attribute__((error("iter_sum without a type needs a typed iterator")));
+
+// Internal: apply X(T, name) to every predefined typed iterator.
+#define _FLOW_TYPED_ITERS(X) \
+    X(char, char) X(signed char, schar) X(unsigned char, uchar) X(short, short) X(unsigned short, ushort) \
+    X(int, int) X(unsigned int, uint) X(long, long) X(unsigned long, ulong) X(long long, llong) \
+    X(unsigned long long, ullong) X(float, float) X(double, double)
+
+#define _FLOW_GENERIC_ERASE(T, name) Iterator_##name: iter_##name##_erase,
+#define _FLOW_GENERIC_FROM(T, name) T: iter_##name##_from,
+#define _FLOW_GENERIC_SUM(T, name) Iterator_##name: iter_##name##_sum,
+#define _FLOW_GENERIC_DOT(T, name) Iterator_##name: iter_##name##_dot,
+#define _FLOW_GENERIC_MIN(T, name) Iterator_##name: iter_##name##_min,
+#define _FLOW_GENERIC_MAX(T, name) Iterator_##name: iter_##name##_max,
+
+/**
+ * @brief Convert a typed iterator handle (or a plain Iterator) to a plain Iterator.
+ * @param it The iterator.
+ * @return Iterator sharing the same data.
+ */
+#define FLOW_ITER(it) ({ __auto_type _fi = (it); _Generic(_fi, _FLOW_TYPED_ITERS(_FLOW_GENERIC_ERASE) default: _flow_iter_id)(_fi); })
+
+/**
+ * @brief Attach an element type to an iterator (typed handle if one is predefined for type).
+ * @param type The element type.
+ * @param it The iterator.
+ * @return Iterator_T for predefined types, otherwise the plain Iterator.
+ */
+#define iter_typed(type, it) _Generic((type){0}, _FLOW_TYPED_ITERS(_FLOW_GENERIC_FROM) default: _flow_iter_id)(FLOW_ITER(it))
+
+/**
+ * @brief Create a typed iterator handle from a static array.
+ * @param arr The static array to convert.
+ * @return Iterator_T matching the array's element type.
+ */
+#define to_iter_typed(arr) iter_typed(typeof(*(arr)), to_iter(arr))
+
+/**
+ * @brief The element type of a typed iterator handle (for use in declarations).
+ * @param it The typed iterator.
+ */
+#define iter_elem_type(it) typeof(*(it).data)
+
+/**
+ * @brief Dot product of two typed iterators (dispatches to iter_T_dot).
+ * @param a The first typed iterator.
+ * @param b The second typed iterator.
+ * @return The dot product.
+ */
+#define iter_dot(a, b) \
+    ({ __auto_type _fa = (a); _Generic(_fa, _FLOW_TYPED_ITERS(_FLOW_GENERIC_DOT) default: _flow_iter_dot_needs_typed_iterator)(_fa, (b)); })
+
+/**
+ * @brief Smallest element of a non-empty typed iterator (dispatches to iter_T_min).
+ * @param it The typed iterator; it.len must be > 0 (asserted), as there is no identity to return.
+ * @return The minimum.
+ */
+#define iter_min(it) \
+    ({ __auto_type _fm = (it); _Generic(_fm, _FLOW_TYPED_ITERS(_FLOW_GENERIC_MIN) default: _flow_iter_min_needs_typed_iterator)(_fm); })
+
+/**
+ * @brief Largest element of a non-empty typed iterator (dispatches to iter_T_max).
+ * @param it The typed iterator; it.len must be > 0 (asserted), as there is no identity to return.
+ * @return The maximum.
+ */
+#define iter_max(it) \
+    ({ __auto_type _fm = (it); _Generic(_fm, _FLOW_TYPED_ITERS(_FLOW_GENERIC_MAX) default: _flow_iter_max_needs_typed_iterator)(_fm); })
+
+#define _iter_sum_1(it) \
+    ({ __auto_type _fs = (it); _Generic(_fs, _FLOW_TYPED_ITERS(_FLOW_GENERIC_SUM) default: _flow_iter_sum_needs_typed_iterator)(_fs); })
+#define _iter_map_4(it, in_var, out_type, out_expr) \
+    iter_typed(out_type, _iter_map_5(it, iter_elem_type(it), in_var, out_type, out_expr))
+#define _iter_filter_3(it, var, predicate) \
+    iter_typed(iter_elem_type(it), _iter_filter_4(it, iter_elem_type(it), var, predicate))
+#define _iter_for_3(it, var, op) \
+    ({ __auto_type _typed = (it); _iter_for_4(_typed, iter_elem_type(_typed), var, op); _typed; })
+#else
+#define FLOW_ITER(it) (it)
+#endif
+
+// Roaring bitmaps: compressed sets of uint32_t split into 2^16-value chunks.
+// Each chunk is stored as a sorted array (<= 4096 values), a 65536-bit bitmap,
+// or a list of runs, whichever is smallest.
+#define FLOW_ROARING_ARRAY 0
+#define FLOW_ROARING_BITMAP 1
+#define FLOW_ROARING_RUN 2
+#define FLOW_ROARING_ARRAY_MAX 4096
+#define FLOW_ROARING_WORDS 1024
+
+typedef struct {
+    uint16_t key;   // high 16 bits shared by every value in the container
+    uint8_t type;   // FLOW_ROARING_ARRAY, FLOW_ROARING_BITMAP or FLOW_ROARING_RUN
+    uint32_t card;  // number of values in the container
+    uint32_t n;     // array: values, run: (start, length - 1) pairs, bitmap: unused
+    void *data;
+} FlowRoaringContainer;
+
+typedef struct {
+    FlowRoaringContainer *containers; // sorted by key
+    size_t len;
+} FlowRoaring;
+
+// Internal: number of runs in a 65536-bit bitmap.
+static inline uint32_t _flow_rc_bitmap_runs(const uint64_t *w) {
+    uint32_t runs = 0;
+    for (size_t i = 0; i < FLOW_ROARING_WORDS; ++i) {
+        uint64_t prev = i ? w[i - 1] >> 63 : 0;
+        runs += (uint32_t)__builtin_popcountll(w[i] & ~((w[i] << 1) | prev));
+    }
+    return runs;
+}
+
+// Internal: expand any container into a zeroed 1024-word bitmap.
+static inline void _flow_rc_to_bitmap(const FlowRoaringContainer *c, uint64_t *w) {
+    if (c->type == FLOW_ROARING_BITMAP) { memcpy(w, c->data, FLOW_ROARING_WORDS * sizeof(uint64_t)); return; }
+    memset(w, 0, FLOW_ROARING_WORDS * sizeof(uint64_t));
+    const uint16_t *v = (const uint16_t *)c->data;
+    if (c->type == FLOW_ROARING_ARRAY) {
+        for (uint32_t i = 0; i < c->n; ++i) w[v[i] >> 6] |= 1ULL << (v[i] & 63);
+        return;
+    }
+    for (uint32_t r = 0; r < c->n; ++r) {
+        uint32_t s = v[2 * r], e = s + v[2 * r + 1]; // inclusive
+        for (uint32_t x = s; x <= e;) {
+            if ((x & 63) == 0 && x + 63 <= e) { w[x >> 6] = ~0ULL; x += 64; }
+            else { w[x >> 6] |= 1ULL << (x & 63); ++x; }
+        }
+    }
+}
+
+// Internal: write the values of a bitmap into a sorted uint16_t array.
+static inline uint32_t _flow_rc_bitmap_values(const uint64_t *w, uint16_t *out) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < FLOW_ROARING_WORDS; ++i)
+        for (uint64_t bits = w[i]; bits; bits &= bits - 1)
+            out[n++] = (uint16_t)(i * 64 + __builtin_ctzll(bits));
+    return n;
+}
+
+// Internal: pick the smallest representation for a container given as a bitmap.
+// Returns 0 (and allocates nothing) when the container is empty.
+static inline int _flow_rc_from_bitmap(const uint64_t *w, uint16_t key, FlowRoaringContainer *c) {
+    uint32_t card = 0;
+    for (size_t i = 0; i < FLOW_ROARING_WORDS; ++i) card += (uint32_t)__builtin_popcountll(w[i]);
+    if (card == 0) return 0;
+    uint32_t runs = _flow_rc_bitmap_runs(w);
+    size_t run_bytes = 4 * (size_t)runs, array_bytes = 2 * (size_t)card, bitmap_bytes = FLOW_ROARING_WORDS * sizeof(uint64_t);
+    *c = (FlowRoaringContainer){ .key = key, .type = FLOW_ROARING_ARRAY, .card = card, .n = 0, .data = NULL };
+    if (run_bytes < array_bytes && run_bytes < bitmap_bytes) {
+        uint16_t *v = (uint16_t *)_flow_alloc(FLOW_OP_ROARING, run_bytes);
+        uint32_t r = 0;
+        for (uint32_t x = 0; x < 65536;) {
+            uint64_t word = w[x >> 6] >> (x & 63);
+            if (!word) { x = (x | 63) + 1; continue; }
+            x += __builtin_ctzll(word);
+            uint32_t s = x;
+            while (x < 65536 && (w[x >> 6] >> (x & 63)) & 1) {
+                uint64_t ones = ~(w[x >> 6] >> (x & 63));
+                x += ones ? (uint32_t)__builtin_ctzll(ones) : 64 - (x & 63);
+            }
+            v[2 * r] = (uint16_t)s;
+            v[2 * r + 1] = (uint16_t)(x - 1 - s);
+            ++r;
+        }
+        c->type = FLOW_ROARING_RUN; c->n = runs; c->data = v;
+    } else if (card <= FLOW_ROARING_ARRAY_MAX) {
+        uint16_t *v = (uint16_t *)_flow_alloc(FLOW_OP_ROARING, array_bytes);
+        c->type = FLOW_ROARING_ARRAY; c->n = _flow_rc_bitmap_values(w, v); c->data = v;
+    } else {
+        uint64_t *v = (uint64_t *)_flow_alloc(FLOW_OP_ROARING, bitmap_bytes);
+        memcpy(v, w, bitmap_bytes);
+        c->type = FLOW_ROARING_BITMAP; c->data = v;
+    }
+    return 1;
+}
+
+// Internal: build an array container from sorted unique values, run-compressing if smaller.
+static inline int _flow_rc_from_array(const uint16_t *v, uint32_t n, uint16_t key, FlowRoaringContainer *c) {
+    if (n == 0) return 0;
+    uint32_t runs = 1;
+    for (uint32_t i = 1; i < n; ++i) runs += v[i] != (uint16_t)(v[i - 1] + 1);
+    if (n > FLOW_ROARING_ARRAY_MAX || 4 * runs < 2 * n) {
+        uint64_t w[FLOW_ROARING_WORDS] = {0};
+        for (uint32_t i = 0; i < n; ++i) w[v[i] >> 6] |= 1ULL << (v[i] & 63);
+        return _flow_rc_from_bitmap(w, key, c);
+    }
+    uint16_t *out = (uint16_t *)_flow_alloc(FLOW_OP_ROARING, n * sizeof(uint16_t));
+    memcpy(out, v, n * sizeof(uint16_t));
+    *c = (FlowRoaringContainer){ .key = key, .type = FLOW_ROARING_ARRAY, .card = n, .n = n, .data = out };
+    return 1;
+}
+
+// Internal: intersect two sorted unique uint16_t arrays. Compares 8x8 blocks with SSE2 when available.
+static inline uint32_t _flow_rc_intersect(const uint16_t *a, uint32_t na, const uint16_t *b, uint32_t nb, uint16_t *out) {
+    uint32_t i = 0, j = 0, k = 0;
+#if defined(__SSE2__)
+    while (i + 8 <= na && j + 8 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i)), hit = _mm_setzero_si128();
+        for (int t = 0; t < 8; ++t)
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi16(va, _mm_set1_epi16((short)b[j + t])));
+        for (unsigned mask = (unsigned)_mm_movemask_epi8(hit); mask; mask &= mask - 1) {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            out[k++] = a[i + bit / 2];
+            mask &= ~(1u << bit); // each 16-bit lane sets two mask bits
+        }
+        uint16_t amax = a[i + 7], bmax = b[j + 7];
+        if (amax <= bmax) i += 8;
+        if (bmax <= amax) j += 8;
+    }
+#endif
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) ++i;
+        else if (b[j] < a[i]) ++j;
+        else { out[k++] = a[i]; ++i; ++j; }
+    }
+    return k;
+}
+
+// Internal: merge two sorted unique arrays for OR (op 1), XOR (op 2) or ANDNOT (op 3).
+static inline uint32_t _flow_rc_merge(const uint16_t *a, uint32_t na, const uint16_t *b, uint32_t nb, uint16_t *out, int op) {
+    uint32_t i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) out[k++] = a[i++];
+        else if (b[j] < a[i]) { if (op != 3) out[k++] = b[j]; ++j; }
+        else { if (op == 1) out[k++] = a[i]; ++i; ++j; }
+    }
+    while (i < na) out[k++] = a[i++];
+    if (op != 3) while (j < nb) out[k++] = b[j++];
+    return k;
+}
+
+#define FLOW_ROARING_AND 0
+#define FLOW_ROARING_OR 1
+#define FLOW_ROARING_XOR 2
+#define FLOW_ROARING_ANDNOT 3
+
+// Internal: combine two containers with the same key. Returns 0 if the result is empty.
+static inline int _flow_rc_combine(const FlowRoaringContainer *x, const FlowRoaringContainer *y, int op, FlowRoaringContainer *c) {
+    if (x->type == FLOW_ROARING_ARRAY && y->type == FLOW_ROARING_ARRAY) {
+        uint16_t buf[2 * FLOW_ROARING_ARRAY_MAX];
+        uint32_t n = op == FLOW_ROARING_AND
+            ? _flow_rc_intersect((const uint16_t *)x->data, x->n, (const uint16_t *)y->data, y->n, buf)
+            : _flow_rc_merge((const uint16_t *)x->data, x->n, (const uint16_t *)y->data, y->n, buf, op);
+        return _flow_rc_from_array(buf, n, x->key, c);
+    }
+    if (x->type == FLOW_ROARING_ARRAY && (op == FLOW_ROARING_AND || op == FLOW_ROARING_ANDNOT)) {
+        // Probe the other container's bitmap instead of materialising the array side.
+        uint64_t w[FLOW_ROARING_WORDS];
+        uint16_t buf[FLOW_ROARING_ARRAY_MAX];
+        _flow_rc_to_bitmap(y, w);
+        const uint16_t *v = (const uint16_t *)x->data;
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < x->n; ++i) {
+            int in = (w[v[i] >> 6] >> (v[i] & 63)) & 1;
+            if (in == (op == FLOW_ROARING_AND)) buf[n++] = v[i];
+        }
+        return _flow_rc_from_array(buf, n, x->key, c);
+    }
+    uint64_t wx[FLOW_ROARING_WORDS], wy[FLOW_ROARING_WORDS];
+    _flow_rc_to_bitmap(x, wx);
+    _flow_rc_to_bitmap(y, wy);
+    for (size_t i = 0; i < FLOW_ROARING_WORDS; ++i) {
+        switch (op) {
+        case FLOW_ROARING_AND: wx[i] &= wy[i]; break;
+        case FLOW_ROARING_OR: wx[i] |= wy[i]; break;
+        case FLOW_ROARING_XOR: wx[i] ^= wy[i]; break;
+        default: wx[i] &= ~wy[i]; break;
+        }
+    }
+    return _flow_rc_from_bitmap(wx, x->key, c);
+}
+
+// Internal: deep-copy a container.
+static inline FlowRoaringContainer _flow_rc_clone(const FlowRoaringContainer *c) {
+    size_t bytes = c->type == FLOW_ROARING_BITMAP ? FLOW_ROARING_WORDS * sizeof(uint64_t)
+                 : c->type == FLOW_ROARING_RUN ? c->n * 2 * sizeof(uint16_t) : c->n * sizeof(uint16_t);
+    FlowRoaringContainer out = *c;
+    out.data = _flow_alloc(FLOW_OP_ROARING, bytes);
+    memcpy(out.data, c->data, bytes);
+    return out;
+}
+
+// Internal: container-wise set operation over two bitmaps.
+static inline FlowRoaring _flow_roaring_op(FlowRoaring a, FlowRoaring b, int op) {
+    FlowRoaring out = { .containers = (FlowRoaringContainer *)_flow_alloc(FLOW_OP_ROARING, (a.len + b.len) * sizeof(FlowRoaringContainer)), .len = 0 };
+    size_t i = 0, j = 0;
+    while (i < a.len || j < b.len) {
+        FlowRoaringContainer *x = i < a.len ? &a.containers[i] : NULL;
+        FlowRoaringContainer *y = j < b.len ? &b.containers[j] : NULL;
+        if (x && y && x->key == y->key) {
+            out.len += _flow_rc_combine(x, y, op, &out.containers[out.len]);
+            ++i; ++j;
+        } else if (x && (!y || x->key < y->key)) {
+            if (op != FLOW_ROARING_AND) out.containers[out.len++] = _flow_rc_clone(x);
+            ++i;
+        } else {
+            if (op == FLOW_ROARING_OR || op == FLOW_ROARING_XOR) out.containers[out.len++] = _flow_rc_clone(y);
+            ++j;
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Build a Roaring bitmap from an iterator of unsigned integers.
+ * @param iter The input iterator (elements of 1, 2, 4 or 8 bytes, values below 2^32).
+ * @return FlowRoaring holding the distinct values of the iterator.
+ */
+static inline FlowRoaring iter_to_roaring(Iterator iter) {
+    uint32_t *vals = (uint32_t *)_flow_alloc(FLOW_OP_ROARING, (iter.len ? iter.len : 1) * sizeof(uint32_t));
+    int sorted = 1;
+    for (size_t i = 0; i < iter.len; ++i) {
+        const char *p = (const char *)iter.data + i * iter.elem_size;
+        switch (iter.elem_size) {
+        case 1: vals[i] = *(const uint8_t *)p; break;
+        case 2: { uint16_t v; memcpy(&v, p, 2); vals[i] = v; } break;
+        case 8: { uint64_t v; memcpy(&v, p, 8); vals[i] = (uint32_t)v; } break;
+        default: memcpy(&vals[i], p, 4); break;
+        }
+        sorted &= i == 0 || vals[i - 1] <= vals[i];
+    }
+    if (!sorted) {
+        // Two-pass LSD radix sort on 16-bit digits.
+        uint32_t *tmp = (uint32_t *)_flow_alloc(FLOW_OP_ROARING, iter.len * sizeof(uint32_t));
+        for (int shift = 0; shift < 32; shift += 16) {
+            size_t *count = (size_t *)_flow_calloc(FLOW_OP_ROARING, 65537, sizeof(size_t));
+            for (size_t i = 0; i < iter.len; ++i) ++count[((vals[i] >> shift) & 0xFFFF) + 1];
+            for (size_t d = 0; d < 65536; ++d) count[d + 1] += count[d];
+            for (size_t i = 0; i < iter.len; ++i) tmp[count[(vals[i] >> shift) & 0xFFFF]++] = vals[i];
+            flow_free(count);
+            uint32_t *swap = vals; vals = tmp; tmp = swap;
+        }
+        flow_free(tmp);
+    }
+    size_t cap = (iter.len >> 16) + 2;
+    FlowRoaring out = { .containers = (FlowRoaringContainer *)_flow_alloc(FLOW_OP_ROARING, cap * sizeof(FlowRoaringContainer)), .len = 0 };
+    uint16_t *buf = (uint16_t *)_flow_alloc(FLOW_OP_ROARING, 65536 * sizeof(uint16_t));
+    for (size_t i = 0; i < iter.len;) {
+        uint32_t key = vals[i] >> 16, n = 0;
+        for (; i < iter.len && vals[i] >> 16 == key; ++i)
+            if (n == 0 || buf[n - 1] != (uint16_t)vals[i]) buf[n++] = (uint16_t)vals[i];
+        if (out.len == cap) {
+            out.containers = (FlowRoaringContainer *)_flow_realloc(FLOW_OP_ROARING, out.containers,
+                cap * sizeof(FlowRoaringContainer), 2 * cap * sizeof(FlowRoaringContainer));
+            cap *= 2;
+        }
+        out.len += _flow_rc_from_array(buf, n, (uint16_t)key, &out.containers[out.len]);
+    }
+    flow_free(buf);
+    flow_free(vals);
+    return out;
+}
+
+/**
+ * @brief Intersection of two Roaring bitmaps.
+ * @param a The first bitmap.
+ * @param b The second bitmap.
+ * @return New FlowRoaring holding values present in both.
+ */
+static inline FlowRoaring roaring_and(FlowRoaring a, FlowRoaring b) { return _flow_roaring_op(a, b, FLOW_ROARING_AND); }
+
+/**
+ * @brief Union of two Roaring bitmaps.
+ * @param a The first bitmap.
+ * @param b The second bitmap.
+ * @return New FlowRoaring holding values present in either.
+ */
+static inline FlowRoaring roaring_or(FlowRoaring a, FlowRoaring b) { return _flow_roaring_op(a, b, FLOW_ROARING_OR); }
+
+/**
+ * @brief Symmetric difference of two Roaring bitmaps.
+ * @param a The first bitmap.
+ * @param b The second bitmap.
+ * @return New FlowRoaring holding values present in exactly one.
+ */
+static inline FlowRoaring roaring_xor(FlowRoaring a, FlowRoaring b) { return _flow_roaring_op(a, b, FLOW_ROARING_XOR); }
+
+/**
+ * @brief Difference of two Roaring bitmaps.
+ * @param a The bitmap to subtract from.
+ * @param b The bitmap to subtract.
+ * @return New FlowRoaring holding values of a that are not in b.
+ */
+static inline FlowRoaring roaring_andnot(FlowRoaring a, FlowRoaring b) { return _flow_roaring_op(a, b, FLOW_ROARING_ANDNOT); }
+
+/**
+ * @brief Number of values in a Roaring bitmap.
+ * @param r The bitmap.
+ * @return The cardinality.
+ */
+static inline size_t roaring_cardinality(FlowRoaring r) {
+    size_t total = 0;
+    for (size_t i = 0; i < r.len; ++i) total += r.containers[i].card;
+    return total;
+}
+
+/**
+ * @brief Check whether a Roaring bitmap contains a value.
+ * @param r The bitmap.
+ * @param value The value to look up.
+ * @return 1 if present, 0 otherwise.
+ */
+static inline int roaring_contains(FlowRoaring r, uint32_t value) {
+    uint16_t key = value >> 16, low = (uint16_t)value;
+    size_t lo = 0, hi = r.len;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (r.containers[mid].key < key) lo = mid + 1; else hi = mid;
+    }
+    if (lo == r.len || r.containers[lo].key != key) return 0;
+    const FlowRoaringContainer *c = &r.containers[lo];
+    const uint16_t *v = (const uint16_t *)c->data;
+    if (c->type == FLOW_ROARING_BITMAP) return (((const uint64_t *)c->data)[low >> 6] >> (low & 63)) & 1;
+    // Array: first value >= low. Run: first run starting after low; the one before it may hold low.
+    lo = 0, hi = c->n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (c->type == FLOW_ROARING_ARRAY ? v[mid] < low : v[2 * mid] <= low) lo = mid + 1; else hi = mid;
+    }
+    if (c->type == FLOW_ROARING_ARRAY) return lo < c->n && v[lo] == low;
+    return lo > 0 && low <= v[2 * (lo - 1)] + v[2 * (lo - 1) + 1];
+}
+
+/**
+ * @brief Convert a Roaring bitmap back to a sorted iterator of uint32_t.
+ * @param r The bitmap.
+ * @return Iterator of the values in ascending order.
+ */
+static inline Iterator iter_from_roaring(FlowRoaring r) {
+    uint32_t *output = (uint32_t *)_flow_alloc(FLOW_OP_ROARING, roaring_cardinality(r) * sizeof(uint32_t));
+    size_t count = 0;
+    for (size_t i = 0; i < r.len; ++i) {
+        const FlowRoaringContainer *c = &r.containers[i];
+        uint32_t high = (uint32_t)c->key << 16;
+        const uint16_t *v = (const uint16_t *)c->data;
+        if (c->type == FLOW_ROARING_ARRAY) {
+            for (uint32_t j = 0; j < c->n; ++j) output[count++] = high | v[j];
+        } else if (c->type == FLOW_ROARING_RUN) {
+            for (uint32_t j = 0; j < c->n; ++j)
+                for (uint32_t x = v[2 * j]; x <= (uint32_t)v[2 * j] + v[2 * j + 1]; ++x) output[count++] = high | x;
+        } else {
+            const uint64_t *w = (const uint64_t *)c->data;
+            for (uint32_t j = 0; j < FLOW_ROARING_WORDS; ++j)
+                for (uint64_t bits = w[j]; bits; bits &= bits - 1)
+                    output[count++] = high | (j * 64 + __builtin_ctzll(bits));
+        }
+    }
+    return (Iterator){ .data = output, .len = count, .elem_size = sizeof(uint32_t), .align = FLOW_ALIGN };
+}
+
+/**
+ * @brief Release the containers of a Roaring bitmap.
+ * @param r The bitmap to free.
+ */
+static inline void roaring_free(FlowRoaring r) {
+    for (size_t i = 0; i < r.len; ++i) flow_free(r.containers[i].data);
+    flow_free(r.containers);
+}
+
+// Dictionary encoding: distinct strings stored once, rows replaced by uint32_t codes.
+#define FLOW_DICT_NONE UINT32_MAX
+
+typedef struct {
+    char *chars;       // NUL-terminated strings stored back to back
+    size_t *offsets;   // offsets[code] is the start of string `code` in chars
+    size_t len;        // number of distinct strings
+    size_t chars_len, chars_cap, cap;
+    uint32_t *slots;   // open-addressing table of code + 1 (0 = empty)
+    size_t slot_mask;
+} FlowDict;
+
+typedef struct { FlowDict dict; Iterator codes; } FlowDictEncoded;
+typedef struct { size_t a, b; } FlowJoinPair;
+
+// Internal: FNV-1a hash of a C string.
+static inline uint64_t _flow_hash_str(const char *s) {
+    uint64_t h = 1469598103934665603ULL;
+    for (; *s; ++s) h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+    return h;
+}
+
+/**
+ * @brief Look up the code of a string in a dictionary.
+ * @param dict The dictionary.
+ * @param str The string to find.
+ * @return The code, or FLOW_DICT_NONE if the string is not in the dictionary.
+ */
+static inline uint32_t dict_lookup(FlowDict dict, const char *str) {
+    if (!dict.slots) return FLOW_DICT_NONE;
+    for (size_t i = _flow_hash_str(str) & dict.slot_mask;; i = (i + 1) & dict.slot_mask) {
+        uint32_t slot = dict.slots[i];
+        if (slot == 0) return FLOW_DICT_NONE;
+        if (strcmp(dict.chars + dict.offsets[slot - 1], str) == 0) return slot - 1;
+    }
+}
+
+/**
+ * @brief Get the string stored for a code.
+ * @param dict The dictionary.
+ * @param code A code produced by the dictionary.
+ * @return Pointer to the NUL-terminated string (owned by the dictionary).
+ */
+static inline char *dict_string(FlowDict dict, uint32_t code) {
+    return dict.chars + dict.offsets[code];
+}
+
+// Internal: return the code for str, adding it to the dictionary if needed.
+static inline uint32_t _flow_dict_intern(FlowDict *d, const char *str) {
+    if (2 * (d->len + 1) > d->slot_mask + 1) {
+        size_t nslots = d->slots ? 2 * (d->slot_mask + 1) : 64;
+        flow_free(d->slots);
+        d->slots = (uint32_t *)_flow_calloc(FLOW_OP_DICT, nslots, sizeof(uint32_t));
+        d->slot_mask = nslots - 1;
+        for (size_t c = 0; c < d->len; ++c) {
+            size_t i = _flow_hash_str(d->chars + d->offsets[c]) & d->slot_mask;
+            while (d->slots[i]) i = (i + 1) & d->slot_mask;
+            d->slots[i] = (uint32_t)c + 1;
+        }
+    }
+    size_t i = _flow_hash_str(str) & d->slot_mask;
+    for (; d->slots[i]; i = (i + 1) & d->slot_mask)
+        if (strcmp(d->chars + d->offsets[d->slots[i] - 1], str) == 0) return d->slots[i] - 1;
+    size_t n = strlen(str) + 1;
+    if (d->chars_len + n > d->chars_cap) {
+        size_t old_cap = d->chars_cap;
+        while (d->chars_len + n > d->chars_cap) d->chars_cap = d->chars_cap ? 2 * d->chars_cap : 256;
+        d->chars = (char *)_flow_realloc(FLOW_OP_DICT, d->chars, old_cap, d->chars_cap);
+    }
+    if (d->len == d->cap) {
+        size_t old_cap = d->cap;
+        d->cap = d->cap ? 2 * d->cap : 16;
+        d->offsets = (size_t *)_flow_realloc(FLOW_OP_DICT, d->offsets, old_cap * sizeof(size_t), d->cap * sizeof(size_t));
+    }
+    memcpy(d->chars + d->chars_len, str, n);
+    d->offsets[d->len] = d->chars_len;
+    d->chars_len += n;
+    d->slots[i] = (uint32_t)d->len + 1;
+    return (uint32_t)d->len++;
+}
+
+/**
+ * @brief Dictionary-encode an iterator of strings.
+ * @param iter The input iterator of char* (NULL entries are not allowed).
+ * @return FlowDictEncoded with the dictionary (.dict) and an iterator of uint32_t codes (.codes).
+ */
+static inline FlowDictEncoded iter_dict_encode(Iterator iter) {
+    FlowDictEncoded out = _FLOW_ZERO;
+    uint32_t *codes = (uint32_t *)_flow_alloc(FLOW_OP_DICT, iter.len * sizeof(uint32_t));
+    for (size_t index = 0; index < iter.len; ++index)
+        codes[index] = _flow_dict_intern(&out.dict, ((char **)iter.data)[index]);
+    out.codes = (Iterator){ .data = codes, .len = iter.len, .elem_size = sizeof(uint32_t), .align = FLOW_ALIGN };
+    return out;
+}
+
+/**
+ * @brief Decode an iterator of codes back to strings.
+ * @param codes The input iterator of uint32_t codes.
+ * @param dict The dictionary that produced the codes.
+ * @return Iterator of char* pointing into the dictionary (valid until dict_free).
+ */
+static inline Iterator iter_dict_decode(Iterator codes, FlowDict dict) {
+    char **output = (char **)_flow_alloc(FLOW_OP_DICT, codes.len * sizeof(char *));
+    for (size_t index = 0; index < codes.len; ++index)
+        output[index] = dict_string(dict, ((uint32_t *)codes.data)[index]);
+    return (Iterator){ .data = output, .len = codes.len, .elem_size = sizeof(char *), .align = FLOW_ALIGN };
+}
+
+/**
+ * @brief Filter codes by a predicate on their strings, evaluated once per distinct string.
+ * @param codes The input iterator of uint32_t codes.
+ * @param dict The dictionary that produced the codes.
+ * @param var The variable name (const char*) for each distinct string.
+ * @param predicate The predicate expression (returns true to keep).
+ * @return Iterator of the codes whose string matches.
+ */
+#define iter_dict_filter(codes, dict, var, predicate) \
+    ({ \
+        Iterator input = (codes); \
+        FlowDict _d = (dict); \
+        unsigned char *keep = _flow_alloc(FLOW_OP_DICT, _d.len ? _d.len : 1); \
+        for (size_t _c = 0; _c < _d.len; ++_c) { \
+            const char *var = dict_string(_d, (uint32_t)_c); \
+            keep[_c] = (predicate) ? 1 : 0; \
+        } \
+        uint32_t *output = _flow_alloc(FLOW_OP_DICT, input.len * sizeof(uint32_t)); \
+        size_t count = 0; \
+        for (size_t index = 0; index < input.len; ++index) { \
+            uint32_t code = ((uint32_t*)input.data)[index]; \
+            output[count] = code; \
+            count += keep[code]; \
+        } \
+        flow_free(keep); \
+        (Iterator){ .data = output, .len = count, .elem_size = sizeof(uint32_t), .align = FLOW_ALIGN }; \
+    })
+
+/**
+ * @brief Count occurrences of each code (group-by count on dictionary codes).
+ * @param codes The input iterator of uint32_t codes.
+ * @param dict The dictionary that produced the codes.
+ * @return Iterator of size_t with one count per dictionary code.
+ */
+static inline Iterator iter_dict_count(Iterator codes, FlowDict dict) {
+    size_t *output = (size_t *)_flow_alloc(FLOW_OP_DICT, dict.len * sizeof(size_t));
+    memset(output, 0, dict.len * sizeof(size_t));
+    for (size_t index = 0; index < codes.len; ++index) ++output[((uint32_t *)codes.data)[index]];
+    return (Iterator){ .data = output, .len = dict.len, .elem_size = sizeof(size_t), .align = FLOW_ALIGN };
+}
+
+/**
+ * @brief Group-by fold: fold the values of iter separately for each code.
+ * @param codes The iterator of uint32_t group codes (one per row).
+ * @param dict The dictionary that produced the codes.
+ * @param iter The iterator of values (same length as codes).
+ * @param type The type of each value.
+ * @param acc_type The type of the accumulator.
+ * @param acc The accumulator variable.
+ * @param in_var The variable name for each value.
+ * @param init The initial value of each group's accumulator.
+ * @param expr The expression to update the accumulator.
+ * @return Iterator of acc_type with one accumulator per dictionary code.
+ */
+#define iter_dict_group_fold(codes, dict, iter, type, acc_type, acc, in_var, init, expr) \
+    ({ \
+        Iterator _keys = FLOW_ITER(codes), input = FLOW_ITER(iter); \
+        FlowDict _d = (dict); \
+        acc_type *output = _flow_alloc(FLOW_OP_DICT, (_d.len ? _d.len : 1) * sizeof(acc_type)); \
+        for (size_t _c = 0; _c < _d.len; ++_c) output[_c] = (init); \
+        size_t _n = _keys.len < input.len ? _keys.len : input.len; \
+        for (size_t index = 0; index < _n; ++index) { \
+            uint32_t _code = ((uint32_t*)_keys.data)[index]; \
+            acc_type acc = output[_code]; \
+            type in_var = ((type*)input.data)[index]; \
+            output[_code] = (expr); \
+        } \
+        (Iterator){ .data = output, .len = _d.len, .elem_size = sizeof(acc_type), .align = FLOW_ALIGN }; \
+    })
+
+/**
+ * @brief Equality join of two dictionary-encoded columns.
+ * @param a_codes The left iterator of uint32_t codes.
+ * @param a_dict The dictionary of the left codes.
+ * @param b_codes The right iterator of uint32_t codes.
+ * @param b_dict The dictionary of the right codes.
+ * @return Iterator of FlowJoinPair (.a, .b row indices) for every pair of equal strings, ordered by b.
+ */
+static inline Iterator iter_dict_join(Iterator a_codes, FlowDict a_dict, Iterator b_codes, FlowDict b_dict) {
+    // Translate b's dictionary into a's code space: one string lookup per distinct value.
+    uint32_t *to_a = (uint32_t *)_flow_alloc(FLOW_OP_DICT, (b_dict.len ? b_dict.len : 1) * sizeof(uint32_t));
+    for (size_t c = 0; c < b_dict.len; ++c) to_a[c] = dict_lookup(a_dict, dict_string(b_dict, (uint32_t)c));
+    // Bucket the rows of a by code (counting sort into offset/row arrays).
+    size_t *start = (size_t *)_flow_calloc(FLOW_OP_DICT, a_dict.len + 1, sizeof(size_t));
+    size_t *rows = (size_t *)_flow_alloc(FLOW_OP_DICT, (a_codes.len ? a_codes.len : 1) * sizeof(size_t));
+    const uint32_t *a = (const uint32_t *)a_codes.data, *b = (const uint32_t *)b_codes.data;
+    for (size_t i = 0; i < a_codes.len; ++i) ++start[a[i] + 1];
+    for (size_t c = 0; c < a_dict.len; ++c) start[c + 1] += start[c];
+    size_t *fill = (size_t *)_flow_alloc(FLOW_OP_DICT, (a_dict.len ? a_dict.len : 1) * sizeof(size_t));
+    memcpy(fill, start, a_dict.len * sizeof(size_t));
+    for (size_t i = 0; i < a_codes.len; ++i) rows[fill[a[i]]++] = i;
+    flow_free(fill);
+    size_t total = 0;
+    for (size_t j = 0; j < b_codes.len; ++j)
+        if (to_a[b[j]] != FLOW_DICT_NONE) total += start[to_a[b[j]] + 1] - start[to_a[b[j]]];
+    FlowJoinPair *output = (FlowJoinPair *)_flow_alloc(FLOW_OP_DICT, (total ? total : 1) * sizeof(FlowJoinPair));
+    size_t count = 0;
+    for (size_t j = 0; j < b_codes.len; ++j) {
+        uint32_t c = to_a[b[j]];
+        if (c == FLOW_DICT_NONE) continue;
+        for (size_t k = start[c]; k < start[c + 1]; ++k) output[count++] = (FlowJoinPair){ .a = rows[k], .b = j };
+    }
+    flow_free(to_a); flow_free(start); flow_free(rows);
+    return (Iterator){ .data = output, .len = count, .elem_size = sizeof(FlowJoinPair), .align = FLOW_ALIGN };
+}
+
+/**
+ * @brief Release the storage of a dictionary.
+ * @param dict The dictionary to free.
+ */
+static inline void dict_free(FlowDict dict) {
+    flow_free(dict.chars);
+    flow_free(dict.offsets);
+    flow_free(dict.slots);
+}
+
+// String iterators: one shared character arena plus per-element offsets (Arrow-style).
+// Strings are stored NUL-terminated, so str_iter_at() is a usable C string.
+typedef struct {
+    char *chars;    // character arena shared by views and filtered copies
+    size_t *starts; // starts[i] is the offset of string i in chars
+    size_t *ends;   // ends[i] is one past the NUL of string i (builder output: starts + 1)
+    size_t len;
+} StrIterator;
+
+typedef struct {
+    char *chars;
+    size_t *offsets; // len + 1 entries once finished
+    size_t len, cap, chars_len, chars_cap;
+} FlowStrBuilder;
+
+// Internal: make room for n more bytes in the builder's arena.
+static inline char *_flow_str_reserve(FlowStrBuilder *b, size_t n) {
+    if (b->chars_len + n > b->chars_cap) {
+        size_t old_cap = b->chars_cap;
+        while (b->chars_len + n > b->chars_cap) b->chars_cap = b->chars_cap ? 2 * b->chars_cap : 256;
+        b->chars = (char *)_flow_realloc(FLOW_OP_STR, b->chars, old_cap, b->chars_cap);
+    }
+    return b->chars + b->chars_len;
+}
+
+// Internal: record the end of the string just written to the arena.
+static inline void _flow_str_commit(FlowStrBuilder *b, size_t n) {
+    if (b->len + 2 > b->cap) {
+        size_t old_cap = b->cap;
+        b->cap = b->cap ? 2 * b->cap : 16;
+        b->offsets = (size_t *)_flow_realloc(FLOW_OP_STR, b->offsets, old_cap * sizeof(size_t), b->cap * sizeof(size_t));
+        if (b->len == 0) b->offsets[0] = 0;
+    }
+    b->chars_len += n;
+    b->offsets[++b->len] = b->chars_len;
+}
+
+/**
+ * @brief Append a copy of a string to a builder.
+ * @param b The builder (zero-initialised before first use).
+ * @param str The NUL-terminated string to copy.
+ */
+static inline void str_builder_append(FlowStrBuilder *b, const char *str) {
+    size_t n = strlen(str) + 1;
+    memcpy(_flow_str_reserve(b, n), str, n);
+    _flow_str_commit(b, n);
+}
+
+/**
+ * @brief Append a printf-formatted string to a builder, formatting directly into the arena.
+ * @param b The builder (zero-initialised before first use).
+ * @param fmt The printf format string.
+ */
+static inline void str_builder_appendf(FlowStrBuilder *b, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    size_t room = b->chars_cap - b->chars_len;
+    int n = vsnprintf(b->chars ? b->chars + b->chars_len : NULL, room, fmt, args);
+    va_end(args);
+    if ((size_t)n + 1 > room) {
+        va_start(args, fmt);
+        vsnprintf(_flow_str_reserve(b, (size_t)n + 1), (size_t)n + 1, fmt, args);
+        va_end(args);
+    }
+    _flow_str_commit(b, (size_t)n + 1);
+}
+
+/**
+ * @brief Finish a builder, handing its arena and offsets to a StrIterator.
+ * @param b The builder (reset to empty afterwards).
+ * @return StrIterator over the appended strings.
+ */
+static inline StrIterator str_builder_finish(FlowStrBuilder *b) {
+    if (b->len == 0 && !b->offsets) b->offsets = (size_t *)_flow_calloc(FLOW_OP_STR, 1, sizeof(size_t));
+    StrIterator out = { .chars = b->chars, .starts = b->offsets, .ends = b->offsets + 1, .len = b->len };
+    *b = (FlowStrBuilder)_FLOW_ZERO;
+    return out;
+}
+
+/**
+ * @brief Get the i-th string of a string iterator.
+ * @param s The string iterator.
+ * @param i The index.
+ * @return Pointer to the NUL-terminated string inside the arena.
+ */
+#define str_iter_at(s, i) ((s).chars + (s).starts[i])
+
+/**
+ * @brief Get the length of the i-th string of a string iterator (without strlen).
+ * @param s The string iterator.
+ * @param i The index.
+ * @return The length in bytes, excluding the terminator.
+ */
+#define str_iter_len_at(s, i) ((s).ends[i] - (s).starts[i] - 1)
+
+/**
+ * @brief Map each element to a string, copying each result into a shared arena.
+ * @param iter The input iterator.
+ * @param in_type The type of each input element.
+ * @param in_var The variable name for each input element.
+ * @param str_expr Expression yielding a const char* (copied immediately, so static buffers are safe).
+ * @return StrIterator of mapped strings.
+ */
+#define iter_map_str(iter, in_type, in_var, str_expr) \
+    ({ \
+        Iterator input = FLOW_ITER(iter); \
+        FlowStrBuilder _b = _FLOW_ZERO; \
+        for (size_t index = 0; index < input.len; ++index) { \
+            in_type in_var = ((in_type*)input.data)[index]; \
+            str_builder_append(&_b, (str_expr)); \
+        } \
+        str_builder_finish(&_b); \
+    })
+
+/**
+ * @brief Format each element with printf-style formatting directly into a shared arena.
+ * @param iter The input iterator.
+ * @param in_type The type of each input element.
+ * @param in_var The variable name for each input element.
+ * @param ... The format string followed by its arguments (may use in_var).
+ * @return StrIterator of formatted strings.
+ */
+#define iter_format(iter, in_type, in_var, ...) \
+    ({ \
+        Iterator input = FLOW_ITER(iter); \
+        FlowStrBuilder _b = _FLOW_ZERO; \
+        for (size_t index = 0; index < input.len; ++index) { \
+            in_type in_var = ((in_type*)input.data)[index]; \
+            str_builder_appendf(&_b, __VA_ARGS__); \
+        } \
+        str_builder_finish(&_b); \
+    })
+
+/**
+ * @brief Apply an operation to each string (side effects only).
+ * @param s The string iterator.
+ * @param var The variable name (char*) for each string.
+ * @param op The operation to perform.
+ * @return The original string iterator (unchanged).
+ */
+#define str_iter_for(s, var, op) \
+    ({ \
+        StrIterator _s = (s); \
+        for (size_t index = 0; index < _s.len; ++index) { \
+            char *var = str_iter_at(_s, index); \
+            op; \
+        } \
+        _s; \
+    })
+
+/**
+ * @brief Filter strings by a predicate; only offsets are copied, the arena is shared.
+ * @param s The string iterator.
+ * @param var The variable name (char*) for each string.
+ * @param predicate The predicate expression (returns true to keep).
+ * @return StrIterator sharing the arena (release with str_iter_free_offsets).
+ */
+#define str_iter_filter(s, var, predicate) \
+    ({ \
+        StrIterator _s = (s); \
+        size_t *_starts = _flow_alloc(FLOW_OP_STR, (2 * _s.len + 1) * sizeof(size_t)); \
+        size_t count = 0; \
+        for (size_t index = 0; index < _s.len; ++index) { \
+            char *var = str_iter_at(_s, index); \
+            if (predicate) _starts[count++] = index; \
+        } \
+        size_t *_ends = _starts + count; \
+        for (size_t _k = count; _k-- > 0;) { \
+            _ends[_k] = _s.ends[_starts[_k]]; \
+            _starts[_k] = _s.starts[_starts[_k]]; \
+        } \
+        (StrIterator){ .chars = _s.chars, .starts = _starts, .ends = _ends, .len = count }; \
+    })
+
+/**
+ * @brief Return a subrange [start, end) of a string iterator without copying.
+ * @param s The string iterator.
+ * @param start The starting index (inclusive).
+ * @param end The ending index (exclusive).
+ * @return StrIterator view over the subrange.
+ */
+#define str_iter_slice(s, start, end) \
+    ({ \
+        StrIterator _s = (s); \
+        size_t _st = (start) < _s.len ? (start) : _s.len; \
+        size_t _en = (end) < _s.len ? (end) : _s.len; \
+        (StrIterator){ .chars = _s.chars, .starts = _s.starts + _st, .ends = _s.ends + _st, .len = (_en > _st ? _en - _st : 0) }; \
+    })
+
+/**
+ * @brief Convert a string iterator to an Iterator of char* pointing into its arena.
+ * @param s The string iterator.
+ * @return Iterator of char* (valid while the arena is alive).
+ */
+static inline Iterator str_iter_to_iter(StrIterator s) {
+    char **output = (char **)_flow_alloc(FLOW_OP_STR, s.len * sizeof(char *));
+    for (size_t index = 0; index < s.len; ++index) output[index] = str_iter_at(s, index);
+    return (Iterator){ .data = output, .len = s.len, .elem_size = sizeof(char *), .align = FLOW_ALIGN };
+}
+
+/**
+ * @brief Release a string iterator produced by a builder (arena and offsets).
+ * @param s The string iterator.
+ */
+static inline void str_iter_free(StrIterator s) {
+    flow_free(s.chars);
+    flow_free(s.starts);
+}
+
+/**
+ * @brief Release the offsets of a filtered string iterator, leaving the shared arena alive.
+ * @param s The string iterator returned by str_iter_filter.
+ */
+static inline void str_iter_free_offsets(StrIterator s) {
+    flow_free(s.starts);
+}
+
+// Nested iterators in CSR form: one values buffer plus an offsets array of len + 1 entries.
+typedef struct {
+    Iterator values;  // elements of every list, back to back
+    size_t *offsets;  // list i is values[offsets[i] .. offsets[i + 1])
+    size_t len;       // number of lists
+} NestedIterator;
+
+/**
+ * @brief Create a nested iterator from a values iterator and an offsets array (no copy).
+ * @param vals The iterator holding every element of every list.
+ * @param offs Array of n + 1 ascending offsets into vals.
+ * @param n The number of lists.
+ * @return NestedIterator viewing values and offsets.
+ */
+#define to_nested(vals, offs, n) \
+    ((NestedIterator){ .values = (vals), .offsets = (offs), .len = (n) })
+
+/**
+ * @brief Convert an iterator of iterators into a nested iterator (one copy of the elements).
+ * @param iter The input iterator of iterators.
+ * @param itertype The type of each inner iterator.
+ * @param elemtype The type of each element in the inner iterators.
+ * @return NestedIterator with freshly allocated values and offsets.
+ */
+#define iter_nest(iter, itertype, elemtype) \
+    ({ \
+        Iterator input = FLOW_ITER(iter); \
+        size_t *offsets = _flow_alloc(FLOW_OP_NESTED, (input.len + 1) * sizeof(size_t)); \
+        offsets[0] = 0; \
+        for (size_t i = 0; i < input.len; ++i) \
+            offsets[i + 1] = offsets[i] + ((itertype*)input.data)[i].len; \
+        elemtype* output = _flow_alloc(FLOW_OP_NESTED, offsets[input.len] * sizeof(elemtype)); \
+        for (size_t i = 0; i < input.len; ++i) { \
+            itertype inner = ((itertype*)input.data)[i]; \
+            memcpy(output + offsets[i], inner.data, inner.len * sizeof(elemtype)); \
+        } \
+        (NestedIterator){ \
+            .values = (Iterator){ .data = output, .len = offsets[input.len], .elem_size = sizeof(elemtype), .align = FLOW_ALIGN }, \
+            .offsets = offsets, .len = input.len }; \
+    })
+
+/**
+ * @brief Release the values and offsets of a nested iterator produced by iter_nest, iter_nested_map
+ * or table_group_by (each owns both buffers). Views made with to_nested are not released this way.
+ * @param nested The nested iterator.
+ */
+static inline void iter_nested_free(NestedIterator nested) {
+    flow_free(nested.values.data);
+    flow_free(nested.offsets);
+}
+
+/**
+ * @brief Flatten a nested iterator (no copy: a view of its values).
+ * @param nested The nested iterator.
+ * @return Iterator over every element of every list.
+ */
+#define iter_nested_flatten(nested) \
+    ({ \
+        NestedIterator _nf = (nested); \
+        iter_slice(_nf.values, _nf.offsets[0], _nf.offsets[_nf.len]); \
+    })
+
+/**
+ * @brief Length of the i-th list of a nested iterator.
+ * @param nested The nested iterator.
+ * @param i The list index.
+ * @return The number of elements in list i.
+ */
+#define iter_nested_len(nested, i) ((nested).offsets[(i) + 1] - (nested).offsets[i])
+
+/**
+ * @brief View the i-th list of a nested iterator (no copy).
+ * @param nested The nested iterator.
+ * @param i The list index.
+ * @return Iterator over the elements of list i.
+ */
+#define iter_nested_at(nested, i) \
+    ({ \
+        NestedIterator _na = (nested); \
+        size_t _ni = (i); \
+        iter_slice(_na.values, _na.offsets[_ni], _na.offsets[_ni + 1]); \
+    })
+
+/**
+ * @brief Lengths of every list of a nested iterator.
+ * @param nested The nested iterator.
+ * @return Iterator of size_t lengths.
+ */
+static inline Iterator iter_nested_lengths(NestedIterator nested) {
+    size_t *output = (size_t *)_flow_alloc(FLOW_OP_NESTED, nested.len * sizeof(size_t));
+    for (size_t index = 0; index < nested.len; ++index) output[index] = nested.offsets[index + 1] - nested.offsets[index];
+    return (Iterator){ .data = output, .len = nested.len, .elem_size = sizeof(size_t), .align = FLOW_ALIGN };
+}
+
+/**
+ * @brief Map every element of every list; the result gets its own copy of the offsets, so input
+ * and result are released independently with iter_nested_free.
+ * @param nested The nested iterator.
+ * @param in_type The type of each input element.
+ * @param in_var The variable name for each input element.
+ * @param out_type The type of each output element.
+ * @param out_expr The expression to compute the output value.
+ * @return NestedIterator with new values and a copy of the offsets.
+ */
+#define iter_nested_map(nested, in_type, in_var, out_type, out_expr) \
+    ({ \
+        NestedIterator _nm = (nested); \
+        size_t *_no = _flow_alloc(FLOW_OP_NESTED, (_nm.len + 1) * sizeof(size_t)); \
+        memcpy(_no, _nm.offsets, (_nm.len + 1) * sizeof(size_t)); \
+        (NestedIterator){ .values = iter_map(_nm.values, in_type, in_var, out_type, out_expr), \
+                          .offsets = _no, .len = _nm.len }; \
+    })
+
+/**
+ * @brief Segmented left fold: fold each list separately.
+ * @param nested The nested iterator.
+ * @param type The type of each element.
+ * @param acc_type The type of the accumulator.
+ * @param acc The accumulator variable.
+ * @param in_var The variable name for each element.
+ * @param init The initial value of each list's accumulator.
+ * @param expr The expression to update the accumulator.
+ * @return Iterator of acc_type with one result per list.
+ */
+#define iter_nested_foldl(nested, type, acc_type, acc, in_var, init, expr) \
+    ({ \
+        NestedIterator _nl = (nested); \
+        acc_type *output = _flow_alloc(FLOW_OP_NESTED, _nl.len * sizeof(acc_type)); \
+        for (size_t _l = 0; _l < _nl.len; ++_l) { \
+            acc_type acc = (init); \
+            for (size_t index = _nl.offsets[_l]; index < _nl.offsets[_l + 1]; ++index) { \
+                type in_var = ((type*)_nl.values.data)[index]; \
+                acc = (expr); \
+            } \
+            output[_l] = acc; \
+        } \
+        (Iterator){ .data = output, .len = _nl.len, .elem_size = sizeof(acc_type), .align = FLOW_ALIGN }; \
+    })
+
+/**
+ * @brief Segmented sum: sum each list separately.
+ * @param nested The nested iterator.
+ * @param type The type of each element (must be numeric).
+ * @return Iterator of type with one sum per list.
+ */
+#define iter_nested_sum(nested, type) \
+    iter_nested_foldl(nested, type, type, _acc, _x, 0, _acc + _x)
+
+// Columnar tables: named, equal-length column iterators plus a shared selection vector.
+// Filters, sorts and group-bys rewrite the selection (physical row indices), never the rows.
+typedef struct {
+    const char **names;
+    Iterator *columns;
+    size_t ncols;
+    size_t *sel;  // selected physical rows in order, NULL = every row
+    size_t len;   // number of selected rows
+} FlowTable;
+
+typedef struct {
+    Iterator keys;        // first row's key for each group, in order of first appearance
+    NestedIterator rows;  // physical row indices (size_t) of each group
+} FlowGroups;
+
+// Internal: table header over caller arrays; every column must have the first one's length.
+static inline FlowTable _flow_table_make(const char **names, Iterator *cols, size_t ncols) {
+    for (size_t c = 1; c < ncols; ++c)
+        if (cols[c].len != cols[0].len) {
+            fprintf(stderr, "flow.h: to_table: column \"%s\" has %zu rows, \"%s\" has %zu\n",
+                    names[c], cols[c].len, names[0], cols[0].len);
+            abort();
+        }
+    return (FlowTable){ .names = names, .columns = cols, .ncols = ncols, .sel = NULL, .len = cols[0].len };
+}
+
+/**
+ * @brief Create a table from static arrays of column names and column iterators.
+ * Columns of different lengths abort with a message, in every build.
+ * @param colnames Static array of column names.
+ * @param cols Static array of column iterators (all the same length).
+ * @return FlowTable viewing the arrays (no selection).
+ */
+#define to_table(colnames, cols) \
+    _flow_table_make((colnames), (cols), sizeof(cols)/sizeof(*(cols)))
+
+/**
+ * @brief Physical row index of the i-th selected row.
+ * @param t The table.
+ * @param i The position in the selection.
+ * @return The physical row index.
+ */
+#define table_row(t, i) ((t).sel ? (t).sel[i] : (size_t)(i))
+
+/**
+ * @brief Find a column by name.
+ * @param t The table.
+ * @param name The column name.
+ * @return The column's index, or t.ncols if there is no such column.
+ */
+static inline size_t table_col_index(FlowTable t, const char *name) {
+    size_t c = 0;
+    while (c < t.ncols && strcmp(t.names[c], name) != 0) ++c;
+    return c;
+}
+
+// Internal: index of a column that must exist; an unknown name aborts in every build.
+static inline size_t _flow_table_col(FlowTable t, const char *name) {
+    size_t c = table_col_index(t, name);
+    if (c == t.ncols) {
+        fprintf(stderr, "flow.h: table has no column \"%s\"\n", name);
+        abort();
+    }
+    return c;
+}
+
+/**
+ * @brief Get a column's physical iterator (ignores the selection).
+ * @param t The table.
+ * @param name The column name (an unknown name aborts with a message, in every build).
+ * @return The column iterator.
+ */
+static inline Iterator table_column(FlowTable t, const char *name) {
+    return t.columns[_flow_table_col(t, name)];
+}
+
+/**
+ * @brief Typed pointer to a column's physical data, for indexing with physical row ids.
+ * @param t The table.
+ * @param type The column's element type.
+ * @param name The column name (an unknown name aborts, as in table_column).
+ * @return Pointer to the first element of the column.
+ */
+#define table_data(t, type, name) ((type*)table_column((t), (name)).data)
+
+// Internal: copy a table's header with a new selection.
+static inline FlowTable _flow_table_with(FlowTable t, size_t ncols, const size_t *cols, size_t *sel, size_t len) {
+    FlowTable out = { .names = (const char **)_flow_alloc(FLOW_OP_TABLE, ncols * sizeof(char *)), .columns = (Iterator *)_flow_alloc(FLOW_OP_TABLE, ncols * sizeof(Iterator)),
+                      .ncols = ncols, .sel = sel, .len = len };
+    for (size_t c = 0; c < ncols; ++c) {
+        out.names[c] = t.names[cols ? cols[c] : c];
+        out.columns[c] = t.columns[cols ? cols[c] : c];
+    }
+    return out;
+}
+
+// Internal: copy the selection vector (or NULL).
+static inline size_t *_flow_table_sel_copy(FlowTable t) {
+    if (!t.sel) return NULL;
+    size_t *sel = (size_t *)_flow_alloc(FLOW_OP_TABLE, t.len * sizeof(size_t));
+    memcpy(sel, t.sel, t.len * sizeof(size_t));
+    return sel;
+}
+
+// Internal: projection by an array of names (an unknown name aborts).
+static inline FlowTable _flow_table_project(FlowTable t, const char **names, size_t n) {
+    size_t *cols = (size_t *)_flow_alloc(FLOW_OP_TABLE, (n ? n : 1) * sizeof(size_t));
+    for (size_t i = 0; i < n; ++i) cols[i] = _flow_table_col(t, names[i]);
+    FlowTable out = _flow_table_with(t, n, cols, _flow_table_sel_copy(t), t.len);
+    flow_free(cols);
+    return out;
+}
+
+/**
+ * @brief Project a table onto some of its columns (column data is shared, not copied).
+ * @param t The table.
+ * @param ... The names of the columns to keep, in output order (an unknown name aborts).
+ * @return FlowTable with the selected columns and the same row selection.
+ */
+#define table_select(t, ...) \
+    ({ \
+        const char *_cols[] = { __VA_ARGS__ }; \
+        _flow_table_project((t), _cols, sizeof(_cols)/sizeof(*_cols)); \
+    })
+
+/**
+ * @brief Filter the rows of a table; only the selection vector is rewritten.
+ * @param t The table.
+ * @param row The variable name (size_t) for each physical row index.
+ * @param predicate The predicate expression (returns true to keep), e.g. price[row] > 10.
+ * @return FlowTable sharing the columns with a narrower selection.
+ */
+#define table_filter(t, row, predicate) \
+    ({ \
+        FlowTable _t = (t); \
+        size_t *_sel = _flow_alloc(FLOW_OP_TABLE, (_t.len ? _t.len : 1) * sizeof(size_t)); \
+        size_t count = 0; \
+        for (size_t index = 0; index < _t.len; ++index) { \
+            size_t row = table_row(_t, index); \
+            if (predicate) _sel[count++] = row; \
+        } \
+        _flow_table_with(_t, _t.ncols, NULL, _sel, count); \
+    })
+
+/**
+ * @brief Stable sort of a table's selection by one column (ascending).
+ * @param t The table.
+ * @param type The key column's element type.
+ * @param name The key column's name.
+ * @return FlowTable sharing the columns with a permuted selection.
+ */
+#define table_sort_by(t, type, name) \
+    ({ \
+        FlowTable _t = (t); \
+        const type *_key = table_data(_t, type, (name)); \
+        size_t *_sel = _flow_alloc(FLOW_OP_TABLE, (_t.len ? _t.len : 1) * sizeof(size_t)); \
+        size_t *_tmp = _flow_alloc(FLOW_OP_TABLE, (_t.len ? _t.len : 1) * sizeof(size_t)); \
+        for (size_t index = 0; index < _t.len; ++index) _sel[index] = table_row(_t, index); \
+        for (size_t _w = 1; _w < _t.len; _w *= 2) { \
+            for (size_t _lo = 0; _lo < _t.len; _lo += 2 * _w) { \
+                size_t _mid = _lo + _w < _t.len ? _lo + _w : _t.len; \
+                size_t _hi = _lo + 2 * _w < _t.len ? _lo + 2 * _w : _t.len; \
+                size_t _i = _lo, _j = _mid, _k = _lo; \
+                while (_i < _mid && _j < _hi) \
+                    _tmp[_k++] = _key[_sel[_j]] < _key[_sel[_i]] ? _sel[_j++] : _sel[_i++]; \
+                while (_i < _mid) _tmp[_k++] = _sel[_i++]; \
+                while (_j < _hi) _tmp[_k++] = _sel[_j++]; \
+            } \
+            size_t *_swap = _sel; _sel = _tmp; _tmp = _swap; \
+        } \
+        flow_free(_tmp); \
+        _flow_table_with(_t, _t.ncols, NULL, _sel, _t.len); \
+    })
+
+/**
+ * @brief Group the selected rows of a table by the bytes of one column.
+ * @param t The table.
+ * @param name The key column's name (use dictionary codes for string keys).
+ * @return FlowGroups with one key per group and each group's physical rows in selection order;
+ * release it with iter_free(groups.keys) and iter_nested_free(groups.rows).
+ */
+static inline FlowGroups table_group_by(FlowTable t, const char *name) {
+    Iterator col = table_column(t, name);
+    size_t nslots = 16;
+    while (nslots < 2 * t.len) nslots *= 2;
+    size_t *slots = (size_t *)_flow_alloc(FLOW_OP_TABLE, nslots * sizeof(size_t));      // group id + 1 (0 = empty)
+    size_t *first = (size_t *)_flow_alloc(FLOW_OP_TABLE, (t.len ? t.len : 1) * sizeof(size_t)); // first row of each group
+    size_t *group = (size_t *)_flow_alloc(FLOW_OP_TABLE, (t.len ? t.len : 1) * sizeof(size_t)); // group of each selected row
+    size_t ngroups = 0;
+    memset(slots, 0, nslots * sizeof(size_t));
+    for (size_t index = 0; index < t.len; ++index) {
+        size_t row = table_row(t, index);
+        const unsigned char *key = (const unsigned char *)col.data + row * col.elem_size;
+        uint64_t h = 1469598103934665603ULL;
+        for (size_t b = 0; b < col.elem_size; ++b) h = (h ^ key[b]) * 1099511628211ULL;
+        size_t s = h & (nslots - 1);
+        while (slots[s] && memcmp((const char *)col.data + first[slots[s] - 1] * col.elem_size, key, col.elem_size) != 0)
+            s = (s + 1) & (nslots - 1);
+        if (!slots[s]) { first[ngroups] = row; slots[s] = ++ngroups; }
+        group[index] = slots[s] - 1;
+    }
+    flow_free(slots);
+    size_t *offsets = (size_t *)_flow_calloc(FLOW_OP_TABLE, ngroups + 1, sizeof(size_t));
+    size_t *rows = (size_t *)_flow_alloc(FLOW_OP_TABLE, (t.len ? t.len : 1) * sizeof(size_t));
+    for (size_t index = 0; index < t.len; ++index) ++offsets[group[index] + 1];
+    for (size_t g = 0; g < ngroups; ++g) offsets[g + 1] += offsets[g];
+    size_t *fill = (size_t *)_flow_alloc(FLOW_OP_TABLE, (ngroups ? ngroups : 1) * sizeof(size_t));
+    memcpy(fill, offsets, ngroups * sizeof(size_t));
+    for (size_t index = 0; index < t.len; ++index) rows[fill[group[index]]++] = table_row(t, index);
+    void *keys = _flow_alloc(FLOW_OP_TABLE, (ngroups ? ngroups : 1) * col.elem_size);
+    for (size_t g = 0; g < ngroups; ++g)
+        memcpy((char *)keys + g * col.elem_size, (const char *)col.data + first[g] * col.elem_size, col.elem_size);
+    flow_free(fill); flow_free(group); flow_free(first);
+    return (FlowGroups){
+        .keys = (Iterator){ .data = keys, .len = ngroups, .elem_size = col.elem_size, .align = FLOW_ALIGN },
+        .rows = (NestedIterator){ .values = (Iterator){ .data = rows, .len = t.len, .elem_size = sizeof(size_t), .align = FLOW_ALIGN },
+                                  .offsets = offsets, .len = ngroups } };
+}
+
+/**
+ * @brief Fold one column of a table separately for each group.
+ * @param t The table.
+ * @param groups Groups produced by table_group_by on the same table.
+ * @param type The column's element type.
+ * @param name The column to aggregate.
+ * @param acc_type The type of the accumulator.
+ * @param acc The accumulator variable.
+ * @param in_var The variable name for each value.
+ * @param init The initial value of each group's accumulator.
+ * @param expr The expression to update the accumulator.
+ * @return Iterator of acc_type with one result per group.
+ */
+#define table_group_fold(t, groups, type, name, acc_type, acc, in_var, init, expr) \
+    ({ \
+        const type *_col = table_data((t), type, (name)); \
+        iter_nested_foldl((groups).rows, size_t, acc_type, acc, _row, init, \
+                          ({ type in_var = _col[_row]; (expr); })); \
+    })
+
+/**
+ * @brief Apply an operation to each selected row (side effects only).
+ * @param t The table.
+ * @param row The variable name (size_t) for each physical row index.
+ * @param op The operation to perform.
+ * @return The original table (unchanged).
+ */
+#define table_for(t, row, op) \
+    ({ \
+        FlowTable _t = (t); \
+        for (size_t index = 0; index < _t.len; ++index) { \
+            size_t row = table_row(_t, index); \
+            op; \
+        } \
+        _t; \
+    })
+
+/**
+ * @brief Map each selected row to a value (row-wise pipeline into a new column).
+ * @param t The table.
+ * @param row The variable name (size_t) for each physical row index.
+ * @param out_type The type of each output element.
+ * @param out_expr The expression to compute the output value.
+ * @return Iterator with one value per selected row.
+ */
+#define table_map(t, row, out_type, out_expr) \
+    ({ \
+        FlowTable _t = (t); \
+        out_type *output = _flow_alloc(FLOW_OP_TABLE, _t.len * sizeof(out_type)); \
+        for (size_t index = 0; index < _t.len; ++index) { \
+            size_t row = table_row(_t, index); \
+            output[index] = (out_expr); \
+        } \
+        (Iterator){ .data = output, .len = _t.len, .elem_size = sizeof(out_type), .align = FLOW_ALIGN }; \
+    })
+
+/**
+ * @brief Gather the selected rows of every column into new contiguous columns.
+ * @param t The table.
+ * @return FlowTable owning freshly allocated columns and no selection.
+ */
+static inline FlowTable table_materialize(FlowTable t) {
+    FlowTable out = _flow_table_with(t, t.ncols, NULL, NULL, t.len);
+    for (size_t c = 0; c < t.ncols; ++c) {
+        Iterator col = t.columns[c];
+        char *output = (char *)_flow_alloc(FLOW_OP_TABLE, t.len * col.elem_size);
+        for (size_t index = 0; index < t.len; ++index)
+            memcpy(output + index * col.elem_size, (char *)col.data + table_row(t, index) * col.elem_size, col.elem_size);
+        out.columns[c] = (Iterator){ .data = output, .len = t.len, .elem_size = col.elem_size, .align = FLOW_ALIGN };
+    }
+    return out;
+}
+
+/**
+ * @brief Release a table returned by a table_* operation (header arrays and selection, not column data).
+ * @param t The table.
+ */
+static inline void table_free(FlowTable t) {
+    flow_free(t.names);
+    flow_free(t.columns);
+    flow_free(t.sel);
+}
+
+// pipe() profiler: compile with -DFLOW_PROFILE and every pipe(...) call site keeps a table of
+// per-step wall time, input/output lengths (for Iterator values), bytes allocated and call counts.
+// Dump all sites with flow_profile_dump(stderr) or flow_profile_dump_json(file).
+#define FLOW_PROFILE_MAX_STEPS 10
+
+/** @brief Accumulated measurements for one step of a pipe() call site. */
+typedef struct {
+    size_t calls;
+    uint64_t ns;      // total wall time
+    size_t in_len;    // total input length (Iterator values only)
+    size_t out_len;   // total output length (Iterator values only)
+    size_t bytes;     // total bytes allocated by flow.h during the step
+} FlowProfileStep;
+
+/** @brief One pipe() call site; sites link themselves into flow_profile_sites on first use. */
+typedef struct FlowProfileSite {
+    const char *file;
+    int line;
+    const char *src; // source text of the pipe(...) arguments
+    size_t nsteps;
+    int registered;
+    struct FlowProfileSite *next;
+    FlowProfileStep steps[FLOW_PROFILE_MAX_STEPS];
+} FlowProfileSite;
+
+// Head of the list of profiled call sites, shared by every translation unit.
+__attribute__((weak)) FlowProfileSite *flow_profile_sites;
+
+// Internal: add a call site to flow_profile_sites the first time it runs.
+static inline void _flow_profile_register(FlowProfileSite *site) {
+    if (__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE)) return;
+    if (__atomic_exchange_n(&site->registered, 1, __ATOMIC_ACQ_REL)) return;
+    site->next = __atomic_load_n(&flow_profile_sites, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&flow_profile_sites, &site->next, site, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+}
+
+// Internal: accumulate one execution of a step.
+static inline void _flow_profile_record(FlowProfileStep *s, uint64_t ns, size_t in_len, size_t out_len, size_t bytes) {
+    __atomic_fetch_add(&s->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->in_len, in_len, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->out_len, out_len, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->bytes, bytes, __ATOMIC_RELAXED);
+}
+
+// Internal: length of a pipe value if it is an Iterator or typed handle, otherwise 0.
+static inline size_t _flow_profile_len(const void *it) { return ((const Iterator *)it)->len; }
+static inline size_t _flow_profile_nolen(const void *value) { (void)value; return 0; }
+#ifndef __cplusplus
+#define _FLOW_GENERIC_LEN(T, name) Iterator_##name: _flow_profile_len,
+#define _FLOW_PROFILE_LEN(x) \
+    _Generic((x), Iterator: _flow_profile_len, _FLOW_TYPED_ITERS(_FLOW_GENERIC_LEN) default: _flow_profile_nolen)((const void *)&(x))
+#else
+#define _FLOW_PROFILE_LEN(x) _flow_profile_nolen(&(x))
+#endif
+
+// Internal: the static table for the enclosing pipe() call site. The source text comes from the
+// _flow_pipe_src declared by pipe() (macro arguments are already expanded inside PIPE_STEP_N).
+#define _FLOW_PROFILE_SITE(n) \
+    static FlowProfileSite _flow_site = { __FILE__, __LINE__, _flow_pipe_src, n, 0, NULL, { { 0, 0, 0, 0, 0 } } }; \
+    _flow_profile_register(&_flow_site)
+#ifdef FLOW_PROFILE
+// Internal: source text seen by PIPE_STEP_N when it is used without pipe().
+static const char _flow_pipe_src[] __attribute__((unused)) = "";
+#endif
+
+// Internal: the i-th top-level comma-separated argument in src (0 = the initial value), trimmed.
+static inline const char *_flow_profile_arg(const char *src, size_t i, int *len) {
+    int depth = 0;
+    char quote = 0;
+    const char *start = src, *p = src;
+    for (;; ++p) {
+        char c = *p;
+        if (quote) {
+            if (c == '\\' && p[1]) ++p;
+            else if (c == quote) quote = 0;
+            if (c) continue;
+        }
+        if (c == '"' || c == '\'') quote = c;
+        else if (c == '(' || c == '[' || c == '{') ++depth;
+        else if (c == ')' || c == ']' || c == '}') --depth;
+        else if (c == 0 || (c == ',' && depth == 0)) {
+            if (i == 0) break;
+            if (c == 0) { start = p; break; }
+            --i;
+            start = p + 1;
+        }
+    }
+    while (start < p && (*start == ' ' || *start == '\t' || *start == '\n')) ++start;
+    const char *end = p;
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n')) --end;
+    *len = (int)(end - start);
+    return start;
+}
+
+// Internal: run one pipe() step and record it in slot i of the call site's table.
+#define _FLOW_PROFILE_STEP(i, s) \
+    do { \
+        size_t _in = _FLOW_PROFILE_LEN(PIPE_PLACEHOLDER), _b0 = _flow_thread_bytes; \
+        uint64_t _t0 = _flow_now_ns(); \
+        PIPE_PLACEHOLDER = (s); \
+        uint64_t _t1 = _flow_now_ns(); \
+        _flow_profile_record(&_flow_site.steps[i], _t1 - _t0, _in, _FLOW_PROFILE_LEN(PIPE_PLACEHOLDER), _flow_thread_bytes - _b0); \
+    } while (0)
+
+/** @brief Clear the measurements of every profiled call site. */
+static inline void flow_profile_reset(void) {
+    for (FlowProfileSite *site = __atomic_load_n(&flow_profile_sites, __ATOMIC_ACQUIRE); site; site = site->next)
+        for (size_t i = 0; i < site->nsteps; ++i) {
+            FlowProfileStep *s = &site->steps[i];
+            __atomic_store_n(&s->calls, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&s->ns, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&s->in_len, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&s->out_len, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&s->bytes, 0, __ATOMIC_RELAXED);
+        }
+}
+
+/**
+ * @brief Print every profiled pipe() call site as a table, one row per step.
+ * @param out Destination stream (e.g. stderr).
+ */
+static inline void flow_profile_dump(FILE *out) {
+#ifndef FLOW_PROFILE
+    fprintf(out, "flow profile: disabled (compile with -DFLOW_PROFILE)\n");
+    return;
+#endif
+    for (FlowProfileSite *site = __atomic_load_n(&flow_profile_sites, __ATOMIC_ACQUIRE); site; site = site->next) {
+        uint64_t total = 0;
+        for (size_t i = 0; i < site->nsteps; ++i) total += site->steps[i].ns;
+        fprintf(out, "pipe %s:%d (%.3f ms total)\n", site->file, site->line, total / 1e6);
+        fprintf(out, "  %-4s %10s %12s %6s %14s %14s %14s  %s\n", "step", "calls", "ms", "%", "in_len", "out_len", "bytes", "expr");
+        for (size_t i = 0; i < site->nsteps; ++i) {
+            const FlowProfileStep *s = &site->steps[i];
+            int len;
+            const char *expr = _flow_profile_arg(site->src, i + 1, &len);
+            fprintf(out, "  %-4zu %10zu %12.3f %6.1f %14zu %14zu %14zu  %.*s\n", i + 1, s->calls, s->ns / 1e6,
+                    total ? 100.0 * s->ns / total : 0.0, s->in_len, s->out_len, s->bytes, len, expr);
+        }
+    }
+}
+
+// Internal: write the first len bytes of str as a JSON string literal.
+static inline void _flow_json_string(FILE *out, const char *str, int len) {
+    fputc('"', out);
+    for (const char *end = str + len; str < end; ++str) {
+        unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+/**
+ * @brief Write every profiled pipe() call site as a JSON array:
+ * [{"file", "line", "steps": [{"expr", "calls", "ns", "in_len", "out_len", "bytes"}, ...]}, ...]
+ * @param out Destination stream.
+ */
+static inline void flow_profile_dump_json(FILE *out) {
+    fputc('[', out);
+    for (FlowProfileSite *site = __atomic_load_n(&flow_profile_sites, __ATOMIC_ACQUIRE); site; site = site->next) {
+        fprintf(out, "%s{\"file\":", site == flow_profile_sites ? "" : ",");
+        _flow_json_string(out, site->file, (int)strlen(site->file));
+        fprintf(out, ",\"line\":%d,\"steps\":[", site->line);
+        for (size_t i = 0; i < site->nsteps; ++i) {
+            const FlowProfileStep *s = &site->steps[i];
+            int len;
+            const char *expr = _flow_profile_arg(site->src, i + 1, &len);
+            fprintf(out, "%s{\"expr\":", i ? "," : "");
+            _flow_json_string(out, expr, len);
+            fprintf(out, ",\"calls\":%zu,\"ns\":%llu,\"in_len\":%zu,\"out_len\":%zu,\"bytes\":%zu}",
+                    s->calls, (unsigned long long)s->ns, s->in_len, s->out_len, s->bytes);
+        }
+        fputs("]}", out);
+    }
+    fputs("]\n", out);
+}
+
+/**
+ * @brief Write every recorded span as Chrome trace-event JSON (open it in ui.perfetto.dev or
+ * chrome://tracing). Spans still being recorded by other threads may be missing.
+ * @param out Destination stream.
+ */
+static inline void flow_trace_write(FILE *out) {
+#if defined(__unix__) || defined(__APPLE__)
+    int pid = (int)getpid();
+#else
+    int pid = 1;
+#endif
+    const char *sep = "";
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+    for (FlowTraceBuffer *b = __atomic_load_n(&flow_trace_buffers, __ATOMIC_ACQUIRE); b; b = b->next) {
+        size_t len = __atomic_load_n(&b->len, __ATOMIC_ACQUIRE);
+        fprintf(out, "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"flow thread %u\"}}",
+                sep, pid, b->tid, b->tid);
+        sep = ",";
+        for (size_t i = 0; i < len; ++i) {
+            const FlowTraceEvent *e = &b->events[i];
+            fputs(",\n{\"ph\":\"X\",\"cat\":\"flow\",\"name\":", out);
+            _flow_json_string(out, e->name, (int)strlen(e->name));
+            fprintf(out, ",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"lo\":%zu,\"hi\":%zu,\"bytes\":%zu}}",
+                    pid, b->tid, e->ts / 1e3, e->dur / 1e3, e->lo, e->hi, e->bytes);
+        }
+        if (b->dropped)
+            fprintf(out, ",\n{\"ph\":\"i\",\"s\":\"t\",\"name\":\"dropped %zu spans (raise FLOW_TRACE_EVENTS)\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f}",
+                    b->dropped, pid, b->tid, len ? b->events[len - 1].ts / 1e3 : 0.0);
+    }
+    fputs("\n]}\n", out);
+}
+
+// Internal: one instrumented pipe() step: USDT probes flow:pipe_step_entry/exit (line, step,
+// Iterator length) around it, and the profiler table when FLOW_PROFILE is on.
+#ifdef FLOW_PROFILE
+#define _FLOW_PIPE_SITE(n) _FLOW_PROFILE_SITE(n)
+#define _FLOW_PIPE_RUN(i, s) _FLOW_PROFILE_STEP(i, s)
+#else
+#define _FLOW_PIPE_SITE(n) (void)0
+#define _FLOW_PIPE_RUN(i, s) (PIPE_PLACEHOLDER = (s))
+#endif
+#define _FLOW_PIPE_STEP(i, s) \
+    do { \
+        _FLOW_USDT3(pipe_step_entry, __LINE__, (i) + 1, _FLOW_PROFILE_LEN(PIPE_PLACEHOLDER)); \
+        _FLOW_PIPE_RUN(i, s); \
+        _FLOW_USDT3(pipe_step_exit, __LINE__, (i) + 1, _FLOW_PROFILE_LEN(PIPE_PLACEHOLDER)); \
+    } while (0)
+
+// Pipe macros (as before)
+#if defined(FLOW_PROFILE) || defined(FLOW_USDT)
+#define PIPE_STEP_1(init, s1) \
+    ({ _FLOW_PIPE_SITE(1); typeof(init) PIPE_PLACEHOLDER = (init); _FLOW_PIPE_STEP(0, s1); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_2(init, s1, s2) \
+    ({ _FLOW_PIPE_SITE(2); typeof(init) PIPE_PLACEHOLDER = (init); _FLOW_PIPE_STEP(0, s1); _FLOW_PIPE_STEP(1, s2); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_3(init, s1, s2, s3) \
+    ({ _FLOW_PIPE_SITE(3); typeof(init) PIPE_PLACEHOLDER = (init); _FLOW_PIPE_STEP(0, s1); _FLOW_PIPE_STEP(1, s2); _FLOW_PIPE_STEP(2, s3); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_4(init, s1, s2, s3, s4) \
+    ({ _FLOW_PIPE_SITE(4); typeof(init) PIPE_PLACEHOLDER = (init); _FLOW_PIPE_STEP(0, s1); _FLOW_PIPE_STEP(1, s2); _FLOW_PIPE_STEP(2, s3); _FLOW_PIPE_STEP(3, s4); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_5(init, s1, s2, s3, s4, s5) \
+    ({ _FLOW_PIPE_SITE(5); typeof(init) PIPE_PLACEHOLDER = (init); _FLOW_PIPE_STEP(0, s1); _FLOW_PIPE_STEP(1, s2); _FLOW_PIPE_STEP(2, s3); _FLOW_PIPE_STEP(3, s4); _FLOW_PIPE_STEP(4, s5); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_6(init, s1, s2, s3, s4, s5, s6) \
+    ({ _FLOW_PIPE_SITE(6); typeof(init) PIPE_PLACEHOLDER = (init); _FLOW_PIPE_STEP(0, s1); _FLOW_PIPE_STEP(1, s2); _FLOW_PIPE_STEP(2, s3); _FLOW_PIPE_STEP(3, s4); _FLOW_PIPE_STEP(4, s5); _FLOW_PIPE_STEP(5, s6); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_7(init, s1, s2, s3, s4, s5, s6, s7) \
+    ({ _FLOW_PIPE_SITE(7); typeof(init) PIPE_PLACEHOLDER = (init); _FLOW_PIPE_STEP(0, s1); _FLOW_PIPE_STEP(1, s2); _FLOW_PIPE_STEP(2, s3); _FLOW_PIPE_STEP(3, s4); _FLOW_PIPE_STEP(4, s5); _FLOW_PIPE_STEP(5, s6); _FLOW_PIPE_STEP(6, s7); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_8(init, s1, s2, s3, s4, s5, s6, s7, s8) \
+    ({ _FLOW_PIPE_SITE(8); typeof(init) PIPE_PLACEHOLDER = (init); _FLOW_PIPE_STEP(0, s1); _FLOW_PIPE_STEP(1, s2); _FLOW_PIPE_STEP(2, s3); _FLOW_PIPE_STEP(3, s4); _FLOW_PIPE_STEP(4, s5); _FLOW_PIPE_STEP(5, s6); _FLOW_PIPE_STEP(6, s7); _FLOW_PIPE_STEP(7, s8); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_9(init, s1, s2, s3, s4, s5, s6, s7, s8, s9) \
+    ({ _FLOW_PIPE_SITE(9); typeof(init) PIPE_PLACEHOLDER = (init); _FLOW_PIPE_STEP(0, s1); _FLOW_PIPE_STEP(1, s2); _FLOW_PIPE_STEP(2, s3); _FLOW_PIPE_STEP(3, s4); _FLOW_PIPE_STEP(4, s5); _FLOW_PIPE_STEP(5, s6); _FLOW_PIPE_STEP(6, s7); _FLOW_PIPE_STEP(7, s8); _FLOW_PIPE_STEP(8, s9); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_10(init, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10) \
+    ({ _FLOW_PIPE_SITE(10); typeof(init) PIPE_PLACEHOLDER = (init); _FLOW_PIPE_STEP(0, s1); _FLOW_PIPE_STEP(1, s2); _FLOW_PIPE_STEP(2, s3); _FLOW_PIPE_STEP(3, s4); _FLOW_PIPE_STEP(4, s5); _FLOW_PIPE_STEP(5, s6); _FLOW_PIPE_STEP(6, s7); _FLOW_PIPE_STEP(7, s8); _FLOW_PIPE_STEP(8, s9); _FLOW_PIPE_STEP(9, s10); PIPE_PLACEHOLDER; })
+#else
+#define PIPE_STEP_1(init, s1) \
+    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_2(init, s1, s2) \
+    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_3(init, s1, s2, s3) \
+    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_4(init, s1, s2, s3, s4) \
+    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER = (s4); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_5(init, s1, s2, s3, s4, s5) \
+    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER = (s4); PIPE_PLACEHOLDER = (s5); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_6(init, s1, s2, s3, s4, s5, s6) \
+    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER = (s4); PIPE_PLACEHOLDER = (s5); PIPE_PLACEHOLDER = (s6); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_7(init, s1, s2, s3, s4, s5, s6, s7) \
+    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER = (s4); PIPE_PLACEHOLDER = (s5); PIPE_PLACEHOLDER = (s6); PIPE_PLACEHOLDER = (s7); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_8(init, s1, s2, s3, s4, s5, s6, s7, s8) \
+    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER = (s4); PIPE_PLACEHOLDER = (s5); PIPE_PLACEHOLDER = (s6); PIPE_PLACEHOLDER = (s7); PIPE_PLACEHOLDER = (s8); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_9(init, s1, s2, s3, s4, s5, s6, s7, s8, s9) \
+    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER = (s4); PIPE_PLACEHOLDER = (s5); PIPE_PLACEHOLDER = (s6); PIPE_PLACEHOLDER = (s7); PIPE_PLACEHOLDER = (s8); PIPE_PLACEHOLDER = (s9); PIPE_PLACEHOLDER; })
+#define PIPE_STEP_10(init, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10) \
+    ({ typeof(init) PIPE_PLACEHOLDER = (init); PIPE_PLACEHOLDER = (s1); PIPE_PLACEHOLDER = (s2); PIPE_PLACEHOLDER = (s3); PIPE_PLACEHOLDER = (s4); PIPE_PLACEHOLDER = (s5); PIPE_PLACEHOLDER = (s6); PIPE_PLACEHOLDER = (s7); PIPE_PLACEHOLDER = (s8); PIPE_PLACEHOLDER = (s9); PIPE_PLACEHOLDER = (s10); PIPE_PLACEHOLDER; })
+#endif
+
+#define GET_PIPE_MACRO(_1,_2,_3,_4,_5,_6,_7,_8,_9,_10,_11,NAME,...) NAME
+
+#ifdef FLOW_PROFILE
+#define pipe(...) \
+    ({ static const char _flow_pipe_src[] = #__VA_ARGS__; \
+       GET_PIPE_MACRO(__VA_ARGS__, \
+        PIPE_STEP_10, PIPE_STEP_9, PIPE_STEP_8, PIPE_STEP_7, PIPE_STEP_6, \
+        PIPE_STEP_5, PIPE_STEP_4, PIPE_STEP_3, PIPE_STEP_2, PIPE_STEP_1)(__VA_ARGS__); })
+#else
+#define pipe(...) \
+    GET_PIPE_MACRO(__VA_ARGS__, \
+        PIPE_STEP_10, PIPE_STEP_9, PIPE_STEP_8, PIPE_STEP_7, PIPE_STEP_6, \
+        PIPE_STEP_5, PIPE_STEP_4, PIPE_STEP_3, PIPE_STEP_2, PIPE_STEP_1)(__VA_ARGS__)
+#endif
+
+// chain: direct unary function nesting, no placeholder support
+#define CHAIN_2(input, f1)           f1(input)
+#define CHAIN_3(input, f1, f2)       f2(f1(input))
+#define CHAIN_4(input, f1, f2, f3, f4)   f4(f3(f2(f1(input))))
+#define CHAIN_5(input, f1, f2, f3, f4) f4(f3(f2(f1(input))))
+#define CHAIN_6(input, f1, f2, f3, f4, f5) f5(f4(f3(f2(f1(input)))))
+#define CHAIN_7(input, f1, f2, f3, f4, f5, f6) f6(f5(f4(f3(f2(f1(input))))))
+#define CHAIN_8(input, f1, f2, f3, f4, f5, f6, f7) f7(f6(f5(f4(f3(f2(f1(input)))))))
+#define CHAIN_9(input, f1, f2, f3, f4, f5, f6, f7, f8) f8(f7(f6(f5(f4(f3(f2(f1(input))))))))
+#define CHAIN_10(input, f1, f2, f3, f4, f5, f6, f7, f8, f9) f9(f8(f7(f6(f5(f4(f3(f2(f1(input)))))))))
+
+#define GET_CHAIN_MACRO(_1,_2,_3,_4,_5,_6,_7,_8,_9,_10,_11,NAME,...) NAME
+#define chain(...) \
+    GET_CHAIN_MACRO(__VA_ARGS__, \
+        CHAIN_10, CHAIN_9, CHAIN_8, CHAIN_7, CHAIN_6, \
+        CHAIN_5, CHAIN_4, CHAIN_3, CHAIN_2)(__VA_ARGS__)
+
+
+// Non-allocating currying for GCC and Clang: FLOW_DEFINE_CURRY(name, ret, f, T1, ..., TN)
+// generates name(a1), which returns a small closure struct. Each struct stores the arguments
+// captured so far inline (by value) and an .apply trampoline to the next level; applying the
+// last argument calls f. Nothing is heap-allocated, so closures are safe in per-element code.
+//   FLOW_DEFINE_CURRY(add5_c, float, add5, float, float, float, float, float)
+//   float r = capply(add5_c(10), 1, 2, 4, 5);
+#define _FLOW_CURRY_FWD(name, k) typedef struct name##_##k name##_##k;
+#define _FLOW_CURRY_STRUCT_FIRST(name, Next, T, Tnext) \
+    struct name##_1 { Next (*apply)(name##_1, Tnext); T a; };
+#define _FLOW_CURRY_STRUCT(name, k, km1, Next, T, Tnext) \
+    struct name##_##k { Next (*apply)(name##_##k, Tnext); name##_##km1 prev; T a; };
+#define _FLOW_CURRY_STEP(name, k, kp1, Tnext) \
+    static inline name##_##kp1 name##_apply##k(name##_##k c, Tnext v) { \
+        return (name##_##kp1){ .apply = name##_apply##kp1, .prev = c, .a = v }; \
+    }
+#define _FLOW_CURRY_LAST(name, k, ret, f, Tnext) \
+    static inline ret name##_apply##k(name##_##k c, Tnext v) { return f(_FLOW_CURRY_ARGS_##k(c), v); }
+#define _FLOW_CURRY_ENTRY(name, T) \
+    static inline name##_1 name(T v) { return (name##_1){ .apply = name##_apply1, .a = v }; }
+
+// Internal: captured arguments of a level-k closure, outermost first.
+#define _FLOW_CURRY_ARGS_1(c) (c).a
+#define _FLOW_CURRY_ARGS_2(c) _FLOW_CURRY_ARGS_1((c).prev), (c).a
+#define _FLOW_CURRY_ARGS_3(c) _FLOW_CURRY_ARGS_2((c).prev), (c).a
+#define _FLOW_CURRY_ARGS_4(c) _FLOW_CURRY_ARGS_3((c).prev), (c).a
+#define _FLOW_CURRY_ARGS_5(c) _FLOW_CURRY_ARGS_4((c).prev), (c).a
+#define _FLOW_CURRY_ARGS_6(c) _FLOW_CURRY_ARGS_5((c).prev), (c).a
+#define _FLOW_CURRY_ARGS_7(c) _FLOW_CURRY_ARGS_6((c).prev), (c).a
+#define _FLOW_CURRY_ARGS_8(c) _FLOW_CURRY_ARGS_7((c).prev), (c).a
+#define _FLOW_CURRY_ARGS_9(c) _FLOW_CURRY_ARGS_8((c).prev), (c).a
+
+#define _FLOW_CURRY_DEF_1(name, ret, f, T1) \
+    static inline ret name(T1 v) { return f(v); }
+#define _FLOW_CURRY_DEF_2(name, ret, f, T1, T2) \
+    _FLOW_CURRY_FWD(name, 1) \
+    _FLOW_CURRY_STRUCT_FIRST(name, ret, T1, T2) \
+    _FLOW_CURRY_LAST(name, 1, ret, f, T2) \
+    _FLOW_CURRY_ENTRY(name, T1)
+#define _FLOW_CURRY_DEF_3(name, ret, f, T1, T2, T3) \
+    _FLOW_CURRY_FWD(name, 1) _FLOW_CURRY_FWD(name, 2) \
+    _FLOW_CURRY_STRUCT_FIRST(name, name##_2, T1, T2) \
+    _FLOW_CURRY_STRUCT(name, 2, 1, ret, T2, T3) \
+    _FLOW_CURRY_LAST(name, 2, ret, f, T3) \
+    _FLOW_CURRY_STEP(name, 1, 2, T2) \
+    _FLOW_CURRY_ENTRY(name, T1)
+#define _FLOW_CURRY_DEF_4(name, ret, f, T1, T2, T3, T4) \
+    _FLOW_CURRY_FWD(name, 1) _FLOW_CURRY_FWD(name, 2) _FLOW_CURRY_FWD(name, 3) \
+    _FLOW_CURRY_STRUCT_FIRST(name, name##_2, T1, T2) \
+    _FLOW_CURRY_STRUCT(name, 2, 1, name##_3, T2, T3) \
+    _FLOW_CURRY_STRUCT(name, 3, 2, ret, T3, T4) \
+    _FLOW_CURRY_LAST(name, 3, ret, f, T4) \
+    _FLOW_CURRY_STEP(name, 2, 3, T3) \
+    _FLOW_CURRY_STEP(name, 1, 2, T2) \
+    _FLOW_CURRY_ENTRY(name, T1)
+#define _FLOW_CURRY_DEF_5(name, ret, f, T1, T2, T3, T4, T5) \
+    _FLOW_CURRY_FWD(name, 1) _FLOW_CURRY_FWD(name, 2) _FLOW_CURRY_FWD(name, 3) _FLOW_CURRY_FWD(name, 4) \
+    _FLOW_CURRY_STRUCT_FIRST(name, name##_2, T1, T2) \
+    _FLOW_CURRY_STRUCT(name, 2, 1, name##_3, T2, T3) \
+    _FLOW_CURRY_STRUCT(name, 3, 2, name##_4, T3, T4) \
+    _FLOW_CURRY_STRUCT(name, 4, 3, ret, T4, T5) \
+    _FLOW_CURRY_LAST(name, 4, ret, f, T5) \
+    _FLOW_CURRY_STEP(name, 3, 4, T4) \
+    _FLOW_CURRY_STEP(name, 2, 3, T3) \
+    _FLOW_CURRY_STEP(name, 1, 2, T2) \
+    _FLOW_CURRY_ENTRY(name, T1)
+#define _FLOW_CURRY_DEF_6(name, ret, f, T1, T2, T3, T4, T5, T6) \
+    _FLOW_CURRY_FWD(name, 1) _FLOW_CURRY_FWD(name, 2) _FLOW_CURRY_FWD(name, 3) _FLOW_CURRY_FWD(name, 4) _FLOW_CURRY_FWD(name, 5) \
+    _FLOW_CURRY_STRUCT_FIRST(name, name##_2, T1, T2) \
+    _FLOW_CURRY_STRUCT(name, 2, 1, name##_3, T2, T3) \
+    _FLOW_CURRY_STRUCT(name, 3, 2, name##_4, T3, T4) \
+    _FLOW_CURRY_STRUCT(name, 4, 3, name##_5, T4, T5) \
+    _FLOW_CURRY_STRUCT(name, 5, 4, ret, T5, T6) \
+    _FLOW_CURRY_LAST(name, 5, ret, f, T6) \
+    _FLOW_CURRY_STEP(name, 4, 5, T5) \
+    _FLOW_CURRY_STEP(name, 3, 4, T4) \
+    _FLOW_CURRY_STEP(name, 2, 3, T3) \
+    _FLOW_CURRY_STEP(name, 1, 2, T2) \
+    _FLOW_CURRY_ENTRY(name, T1)
+#define _FLOW_CURRY_DEF_7(name, ret, f, T1, T2, T3, T4, T5, T6, T7) \
+    _FLOW_CURRY_FWD(name, 1) _FLOW_CURRY_FWD(name, 2) _FLOW_CURRY_FWD(name, 3) _FLOW_CURRY_FWD(name, 4) _FLOW_CURRY_FWD(name, 5) _FLOW_CURRY_FWD(name, 6) \
+    _FLOW_CURRY_STRUCT_FIRST(name, name##_2, T1, T2) \
+    _FLOW_CURRY_STRUCT(name, 2, 1, name##_3, T2, T3) \
+    _FLOW_CURRY_STRUCT(name, 3, 2, name##_4, T3, T4) \
+    _FLOW_CURRY_STRUCT(name, 4, 3, name##_5, T4, T5) \
+    _FLOW_CURRY_STRUCT(name, 5, 4, name##_6, T5, T6) \
+    _FLOW_CURRY_STRUCT(name, 6, 5, ret, T6, T7) \
+    _FLOW_CURRY_LAST(name, 6, ret, f, T7) \
+    _FLOW_CURRY_STEP(name, 5, 6, T6) \
+    _FLOW_CURRY_STEP(name, 4, 5, T5) \
+    _FLOW_CURRY_STEP(name, 3, 4, T4) \
+    _FLOW_CURRY_STEP(name, 2, 3, T3) \
+    _FLOW_CURRY_STEP(name, 1, 2, T2) \
+    _FLOW_CURRY_ENTRY(name, T1)
+#define _FLOW_CURRY_DEF_8(name, ret, f, T1, T2, T3, T4, T5, T6, T7, T8) \
+    _FLOW_CURRY_FWD(name, 1) _FLOW_CURRY_FWD(name, 2) _FLOW_CURRY_FWD(name, 3) _FLOW_CURRY_FWD(name, 4) _FLOW_CURRY_FWD(name, 5) _FLOW_CURRY_FWD(name, 6) _FLOW_CURRY_FWD(name, 7) \
+    _FLOW_CURRY_STRUCT_FIRST(name, name##_2, T1, T2) \
+    _FLOW_CURRY_STRUCT(name, 2, 1, name##_3, T2, T3) \
+    _FLOW_CURRY_STRUCT(name, 3, 2, name##_4, T3, T4) \
+    _FLOW_CURRY_STRUCT(name, 4, 3, name##_5, T4, T5) \
+    _FLOW_CURRY_STRUCT(name, 5, 4, name##_6, T5, T6) \
+    _FLOW_CURRY_STRUCT(name, 6, 5, name##_7, T6, T7) \
+    _FLOW_CURRY_STRUCT(name, 7, 6, ret, T7, T8) \
+    _FLOW_CURRY_LAST(name, 7, ret, f, T8) \
+    _FLOW_CURRY_STEP(name, 6, 7, T7) \
+    _FLOW_CURRY_STEP(name, 5, 6, T6) \
+    _FLOW_CURRY_STEP(name, 4, 5, T5) \
+    _FLOW_CURRY_STEP(name, 3, 4, T4) \
+    _FLOW_CURRY_STEP(name, 2, 3, T3) \
+    _FLOW_CURRY_STEP(name, 1, 2, T2) \
+    _FLOW_CURRY_ENTRY(name, T1)
+#define _FLOW_CURRY_DEF_9(name, ret, f, T1, T2, T3, T4, T5, T6, T7, T8, T9) \
+    _FLOW_CURRY_FWD(name, 1) _FLOW_CURRY_FWD(name, 2) _FLOW_CURRY_FWD(name, 3) _FLOW_CURRY_FWD(name, 4) _FLOW_CURRY_FWD(name, 5) _FLOW_CURRY_FWD(name, 6) _FLOW_CURRY_FWD(name, 7) _FLOW_CURRY_FWD(name, 8) \
+    _FLOW_CURRY_STRUCT_FIRST(name, name##_2, T1, T2) \
+    _FLOW_CURRY_STRUCT(name, 2, 1, name##_3, T2, T3) \
+    _FLOW_CURRY_STRUCT(name, 3, 2, name##_4, T3, T4) \
+    _FLOW_CURRY_STRUCT(name, 4, 3, name##_5, T4, T5) \
+    _FLOW_CURRY_STRUCT(name, 5, 4, name##_6, T5, T6) \
+    _FLOW_CURRY_STRUCT(name, 6, 5, name##_7, T6, T7) \
+    _FLOW_CURRY_STRUCT(name, 7, 6, name##_8, T7, T8) \
+    _FLOW_CURRY_STRUCT(name, 8, 7, ret, T8, T9) \
+    _FLOW_CURRY_LAST(name, 8, ret, f, T9) \
+    _FLOW_CURRY_STEP(name, 7, 8, T8) \
+    _FLOW_CURRY_STEP(name, 6, 7, T7) \
+    _FLOW_CURRY_STEP(name, 5, 6, T6) \
+    _FLOW_CURRY_STEP(name, 4, 5, T5) \
+    _FLOW_CURRY_STEP(name, 3, 4, T4) \
+    _FLOW_CURRY_STEP(name, 2, 3, T3) \
+    _FLOW_CURRY_STEP(name, 1, 2, T2) \
+    _FLOW_CURRY_ENTRY(name, T1)
+#define _FLOW_CURRY_DEF_10(name, ret, f, T1, T2, T3, T4, T5, T6, T7, T8, T9, T10) \
+    _FLOW_CURRY_FWD(name, 1) _FLOW_CURRY_FWD(name, 2) _FLOW_CURRY_FWD(name, 3) _FLOW_CURRY_FWD(name, 4) _FLOW_CURRY_FWD(name, 5) _FLOW_CURRY_FWD(name, 6) _FLOW_CURRY_FWD(name, 7) _FLOW_CURRY_FWD(name, 8) _FLOW_CURRY_FWD(name, 9) \
+    _FLOW_CURRY_STRUCT_FIRST(name, name##_2, T1, T2) \
+    _FLOW_CURRY_STRUCT(name, 2, 1, name##_3, T2, T3) \
+    _FLOW_CURRY_STRUCT(name, 3, 2, name##_4, T3, T4) \
+    _FLOW_CURRY_STRUCT(name, 4, 3, name##_5, T4, T5) \
+    _FLOW_CURRY_STRUCT(name, 5, 4, name##_6, T5, T6) \
+    _FLOW_CURRY_STRUCT(name, 6, 5, name##_7, T6, T7) \
+    _FLOW_CURRY_STRUCT(name, 7, 6, name##_8, T7, T8) \
+    _FLOW_CURRY_STRUCT(name, 8, 7, name##_9, T8, T9) \
+    _FLOW_CURRY_STRUCT(name, 9, 8, ret, T9, T10) \
+    _FLOW_CURRY_LAST(name, 9, ret, f, T10) \
+    _FLOW_CURRY_STEP(name, 8, 9, T9) \
+    _FLOW_CURRY_STEP(name, 7, 8, T8) \
+    _FLOW_CURRY_STEP(name, 6, 7, T7) \
+    _FLOW_CURRY_STEP(name, 5, 6, T6) \
+    _FLOW_CURRY_STEP(name, 4, 5, T5) \
+    _FLOW_CURRY_STEP(name, 3, 4, T4) \
+    _FLOW_CURRY_STEP(name, 2, 3, T3) \
+    _FLOW_CURRY_STEP(name, 1, 2, T2) \
+    _FLOW_CURRY_ENTRY(name, T1)
+
+/**
+ * @brief Define a curried, allocation-free version of a function.
+ * @param name The name of the generated entry function (and prefix of its closure types).
+ * @param ret The return type of f.
+ * @param f The function to curry.
+ * @param ... The parameter types of f, in order (1 to 10).
+ */
+#define FLOW_DEFINE_CURRY(name, ret, f, ...) \
+    _FLOW_CAT(_FLOW_CURRY_DEF_, _FLOW_NARGS(__VA_ARGS__))(name, ret, f, __VA_ARGS__)
+
+#define _capply_2(c, a1) ({ __auto_type _clo = (c); _clo.apply(_clo, (a1)); })
+#define _capply_3(c, a1, a2) _capply_2(_capply_2(c, a1), a2)
+#define _capply_4(c, a1, a2, a3) _capply_2(_capply_3(c, a1, a2), a3)
+#define _capply_5(c, a1, a2, a3, a4) _capply_2(_capply_4(c, a1, a2, a3), a4)
+#define _capply_6(c, a1, a2, a3, a4, a5) _capply_2(_capply_5(c, a1, a2, a3, a4), a5)
+#define _capply_7(c, a1, a2, a3, a4, a5, a6) _capply_2(_capply_6(c, a1, a2, a3, a4, a5), a6)
+#define _capply_8(c, a1, a2, a3, a4, a5, a6, a7) _capply_2(_capply_7(c, a1, a2, a3, a4, a5, a6), a7)
+#define _capply_9(c, a1, a2, a3, a4, a5, a6, a7, a8) _capply_2(_capply_8(c, a1, a2, a3, a4, a5, a6, a7), a8)
+#define _capply_10(c, a1, a2, a3, a4, a5, a6, a7, a8, a9) _capply_2(_capply_9(c, a1, a2, a3, a4, a5, a6, a7, a8), a9)
+#define _capply_11(c, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10) _capply_2(_capply_10(c, a1, a2, a3, a4, a5, a6, a7, a8, a9), a10)
+
+/**
+ * @brief Apply one or more arguments to a closure from FLOW_DEFINE_CURRY.
+ * @param c The closure (as returned by the entry function or a previous capply).
+ * @param ... The arguments to apply, in order.
+ * @return The next closure, or f's result once every argument has been supplied.
+ */
+#define capply(...) _FLOW_OVERLOAD(_capply_, __VA_ARGS__)
 
 
 #ifdef __clang__
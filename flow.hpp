@@ -0,0 +1,355 @@
+#ifndef FLOW_HPP
+#define FLOW_HPP
+
+// C++ companion to flow.h: the same operators as expression templates over lambdas.
+//
+//   Iterator it = to_iter(arr);                       // plain flow.h iterator
+//   double s = flow::view<int>(it)
+//            | flow::map([](int x) { return x * 0.5; })
+//            | flow::filter([](double x) { return x > 1.0; })
+//            | flow::sum();                            // one fused loop, no temporaries
+//
+// Adaptors (map, filter, zip, scan) only build a small typed expression object; nothing runs
+// until a terminal (fold, sum, count, for_each, collect) is applied, which then drives the
+// whole pipeline as a single inlined loop specialised on the element types. flow::view<T>
+// wraps an Iterator without copying, and collect() returns a regular Iterator (aligned,
+// released with flow_free()), so C and C++ code can hand data back and forth as-is.
+//
+// A view's begin()/end() are plain T* (contiguous random-access iterators), so standard
+// algorithms, including the C++17 parallel overloads, and C++20 ranges consume flow.h data
+// in place; flow::alloc<T>(n) provides an output buffer they can write into.
+
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#if __cplusplus >= 202002L && __has_include(<ranges>)
+#include <ranges>
+#endif
+
+#include "flow.h"
+
+namespace flow {
+
+// Internal: marks expression types so operator| only applies to them.
+struct expr_base {};
+
+template <class E>
+using is_expr = std::is_base_of<expr_base, std::decay_t<E>>;
+
+// Internal: every expression provides
+//   value_type         element type it produces
+//   indexed            true if size() and at(i) are available (random access)
+//   each(sink)         pushes every element into sink(x), stopping early if sink returns false;
+//                      returns false if it was stopped.
+
+/**
+ * @brief Typed, non-owning view over an Iterator (or a raw array).
+ * @tparam T Element type; must match the Iterator's elem_size.
+ */
+template <class T>
+struct view : expr_base {
+    using value_type = T;
+    static constexpr bool indexed = true;
+
+    T *data;
+    size_t len;
+    size_t align;
+
+    view(T *d, size_t n) : data(d), len(n), align(_flow_ptr_align(d)) {}
+    template <size_t N>
+    view(T (&arr)[N]) : data(arr), len(N), align(_flow_ptr_align(arr)) {}
+    explicit view(Iterator it) : data(static_cast<T *>(it.data)), len(it.len), align(it.align) {
+        assert(it.elem_size == sizeof(T) && "flow::view<T>: elem_size does not match T");
+    }
+
+    size_t size() const { return len; }
+    T &at(size_t i) const { return data[i]; }
+    T &operator[](size_t i) const { return data[i]; }
+    T *begin() const { return data; }
+    T *end() const { return data + len; }
+
+    template <class Sink>
+    bool each(Sink &&sink) const {
+        if (align >= FLOW_ALIGN) {
+            const T *p = static_cast<const T *>(__builtin_assume_aligned(data, FLOW_ALIGN));
+            for (size_t i = 0; i < len; ++i)
+                if (!sink(p[i])) return false;
+        } else {
+            for (size_t i = 0; i < len; ++i)
+                if (!sink(data[i])) return false;
+        }
+        return true;
+    }
+
+    /** @brief The same memory as a flow.h Iterator (no copy). */
+    Iterator iter() const {
+        Iterator it;
+        it.data = data;
+        it.len = len;
+        it.elem_size = sizeof(T);
+        it.align = align;
+        return it;
+    }
+    operator Iterator() const { return iter(); }
+};
+
+/** @brief Typed view over an Iterator; shorthand for flow::view<T>(it). */
+template <class T>
+view<T> from(Iterator it) { return view<T>(it); }
+
+/**
+ * @brief Allocates an uninitialised output buffer of n elements (FLOW_ALIGN-aligned).
+ *
+ * Meant as the destination of standard algorithms, e.g.
+ * std::transform(std::execution::par_unseq, in.begin(), in.end(), out.begin(), f);
+ * the view converts to an Iterator and is released with flow_free(out.data).
+ */
+template <class T>
+view<T> alloc(size_t n) {
+    return view<T>(static_cast<T *>(_flow_alloc(FLOW_OP_CPP, n * sizeof(T))), n);
+}
+
+/**
+ * @brief Copies any finite range (a container or a C++20 ranges pipeline) into a new Iterator.
+ * @return Iterator owning an aligned buffer, released with flow_free().
+ */
+template <class R, class = std::enable_if_t<!is_expr<R>::value>>
+Iterator materialize(R &&r) {
+#if defined(__cpp_lib_ranges)
+    auto first = std::ranges::begin(r);
+    auto last = std::ranges::end(r);
+    size_t n = static_cast<size_t>(std::ranges::distance(first, last));
+#else
+    using std::begin;
+    using std::end;
+    auto first = begin(r);
+    auto last = end(r);
+    size_t n = static_cast<size_t>(std::distance(first, last));
+#endif
+    using T = std::decay_t<decltype(*first)>;
+    static_assert(std::is_trivially_copyable<T>::value, "flow::materialize: element type must be trivially copyable");
+    view<T> out = alloc<T>(n);
+    for (T *p = out.data; first != last; ++first) *p++ = *first;
+    return out.iter();
+}
+
+// Internal: map expression; keeps random access when its source has it.
+template <class Src, class F>
+struct map_expr : expr_base {
+    using value_type = std::decay_t<std::invoke_result_t<const F &, const typename Src::value_type &>>;
+    static constexpr bool indexed = Src::indexed;
+    Src src;
+    F f;
+
+    size_t size() const { return src.size(); }
+    value_type at(size_t i) const { return f(src.at(i)); }
+
+    template <class Sink>
+    bool each(Sink &&sink) const {
+        return src.each([&](const auto &x) { return sink(f(x)); });
+    }
+};
+
+// Internal: filter expression; its length is only known after running it.
+template <class Src, class P>
+struct filter_expr : expr_base {
+    using value_type = typename Src::value_type;
+    static constexpr bool indexed = false;
+    Src src;
+    P pred;
+
+    template <class Sink>
+    bool each(Sink &&sink) const {
+        return src.each([&](const auto &x) { return pred(x) ? sink(x) : true; });
+    }
+};
+
+// Internal: inclusive scan expression; carries the running accumulator through the loop.
+template <class Src, class A, class F>
+struct scan_expr : expr_base {
+    using value_type = A;
+    static constexpr bool indexed = false;
+    Src src;
+    A init;
+    F f;
+
+    template <class Sink>
+    bool each(Sink &&sink) const {
+        A acc = init;
+        return src.each([&](const auto &x) {
+            acc = f(acc, x);
+            return sink(static_cast<const A &>(acc));
+        });
+    }
+};
+
+// Internal: zip expression; pairs elements up to the shorter of the two inputs.
+template <class A, class B>
+struct zip_expr : expr_base {
+    static_assert(A::indexed && B::indexed, "flow::zip: both inputs need random access (no filter/scan)");
+    using value_type = std::pair<typename A::value_type, typename B::value_type>;
+    static constexpr bool indexed = true;
+    A a;
+    B b;
+
+    size_t size() const { return a.size() < b.size() ? a.size() : b.size(); }
+    value_type at(size_t i) const { return value_type(a.at(i), b.at(i)); }
+
+    template <class Sink>
+    bool each(Sink &&sink) const {
+        size_t n = size();
+        for (size_t i = 0; i < n; ++i)
+            if (!sink(at(i))) return false;
+        return true;
+    }
+};
+
+// Internal: adaptor and terminal objects, applied with operator|.
+template <class F> struct map_fn { F f; };
+template <class P> struct filter_fn { P pred; };
+template <class A, class F> struct scan_fn { A init; F f; };
+template <class A, class F> struct fold_fn { A init; F f; };
+template <class F> struct for_each_fn { F f; };
+struct sum_fn {};
+struct count_fn {};
+struct collect_fn {};
+
+/** @brief Lazily applies f to each element. */
+template <class F>
+map_fn<F> map(F f) { return {std::move(f)}; }
+
+/** @brief Lazily keeps elements for which pred(x) is true. */
+template <class P>
+filter_fn<P> filter(P pred) { return {std::move(pred)}; }
+
+/** @brief Lazily yields acc = f(acc, x) for each element, starting from init. */
+template <class A, class F>
+scan_fn<A, F> scan(A init, F f) { return {std::move(init), std::move(f)}; }
+
+/** @brief Terminal: left fold, acc = f(acc, x), starting from init. */
+template <class A, class F>
+fold_fn<A, F> fold(A init, F f) { return {std::move(init), std::move(f)}; }
+
+/** @brief Terminal: calls f(x) for every element. */
+template <class F>
+for_each_fn<F> for_each(F f) { return {std::move(f)}; }
+
+/** @brief Terminal: sum of the elements, in the element type. */
+inline sum_fn sum() { return {}; }
+
+/** @brief Terminal: number of elements produced. */
+inline count_fn count() { return {}; }
+
+/** @brief Terminal: materialises the pipeline into a new flow.h Iterator (release with iter_free()). */
+inline collect_fn collect() { return {}; }
+
+/** @brief Lazily pairs two random-access expressions (views, maps, zips) element-wise. */
+template <class A, class B, class = std::enable_if_t<is_expr<A>::value && is_expr<B>::value>>
+zip_expr<std::decay_t<A>, std::decay_t<B>> zip(A &&a, B &&b) {
+    return {{}, std::forward<A>(a), std::forward<B>(b)};
+}
+
+template <class E, class F, class = std::enable_if_t<is_expr<E>::value>>
+map_expr<std::decay_t<E>, F> operator|(E &&e, map_fn<F> m) {
+    return {{}, std::forward<E>(e), std::move(m.f)};
+}
+
+template <class E, class P, class = std::enable_if_t<is_expr<E>::value>>
+filter_expr<std::decay_t<E>, P> operator|(E &&e, filter_fn<P> p) {
+    return {{}, std::forward<E>(e), std::move(p.pred)};
+}
+
+template <class E, class A, class F, class = std::enable_if_t<is_expr<E>::value>>
+scan_expr<std::decay_t<E>, A, F> operator|(E &&e, scan_fn<A, F> s) {
+    return {{}, std::forward<E>(e), std::move(s.init), std::move(s.f)};
+}
+
+template <class E, class A, class F, class = std::enable_if_t<is_expr<E>::value>>
+A operator|(const E &e, fold_fn<A, F> fo) {
+    A acc = fo.init;
+    e.each([&](const auto &x) {
+        acc = fo.f(acc, x);
+        return true;
+    });
+    return acc;
+}
+
+template <class E, class F, class = std::enable_if_t<is_expr<E>::value>>
+void operator|(const E &e, for_each_fn<F> fe) {
+    e.each([&](const auto &x) {
+        fe.f(x);
+        return true;
+    });
+}
+
+template <class E, class = std::enable_if_t<is_expr<E>::value>>
+typename E::value_type operator|(const E &e, sum_fn) {
+    typename E::value_type acc{};
+    e.each([&](const auto &x) {
+        acc += x;
+        return true;
+    });
+    return acc;
+}
+
+template <class E, class = std::enable_if_t<is_expr<E>::value>>
+size_t operator|(const E &e, count_fn) {
+    if constexpr (E::indexed) {
+        return e.size();
+    } else {
+        size_t n = 0;
+        e.each([&](const auto &) {
+            ++n;
+            return true;
+        });
+        return n;
+    }
+}
+
+template <class E, class = std::enable_if_t<is_expr<E>::value>>
+Iterator operator|(const E &e, collect_fn) {
+    using T = typename E::value_type;
+    static_assert(std::is_trivially_copyable<T>::value, "flow::collect: element type must be trivially copyable");
+    Iterator out;
+    out.elem_size = sizeof(T);
+    out.align = FLOW_ALIGN;
+    if constexpr (E::indexed) {
+        // Exact size known up front: one allocation, one loop.
+        size_t n = e.size();
+        T *output = static_cast<T *>(__builtin_assume_aligned(_flow_alloc(FLOW_OP_CPP, n * sizeof(T)), FLOW_ALIGN));
+        for (size_t i = 0; i < n; ++i) output[i] = e.at(i);
+        out.data = output;
+        out.len = n;
+    } else {
+        // Unknown size (filter/scan): grow geometrically.
+        size_t cap = 16, n = 0;
+        T *output = static_cast<T *>(_flow_alloc(FLOW_OP_CPP, cap * sizeof(T)));
+        e.each([&](const T &x) {
+            if (n == cap) {
+                T *grown = static_cast<T *>(_flow_alloc(FLOW_OP_CPP, (cap *= 2) * sizeof(T)));
+                memcpy(grown, output, n * sizeof(T));
+                flow_free(output);
+                output = grown;
+            }
+            output[n++] = x;
+            return true;
+        });
+        out.data = output;
+        out.len = n;
+    }
+    return out;
+}
+
+} // namespace flow
+
+#if defined(__cpp_lib_ranges)
+// flow::view<T> is a cheap, non-owning contiguous range: usable directly in std::views pipelines.
+template <class T>
+inline constexpr bool std::ranges::enable_view<flow::view<T>> = true;
+template <class T>
+inline constexpr bool std::ranges::enable_borrowed_range<flow::view<T>> = true;
+#endif
+
+#endif // FLOW_HPP
@@ -0,0 +1,86 @@
+// Samples the live operator counters of a process built with -DFLOW_METRICS and prints, per
+// interval, the calls, elements and bytes per second of each operator plus the share of the
+// interval spent inside it (summed over threads, so it can exceed 100%).
+//
+// Build and run from the repository root:
+//   gcc -O2 -o /tmp/flow_metrics tools/flow_metrics.c
+//   /tmp/flow_metrics [-i seconds] [-n samples] PID|/shm-name
+
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../flow.h"
+
+// Totals of one operator over every thread slot.
+typedef struct {
+    uint64_t calls, elems, bytes, ns;
+} Totals;
+
+static void sum_slots(const FlowMetrics *m, Totals *t) {
+    memset(t, 0, m->nops * sizeof(Totals));
+    uint32_t used = __atomic_load_n(&m->used, __ATOMIC_RELAXED);
+    for (uint32_t s = 0; s < used && s < m->nslots; ++s)
+        for (uint32_t i = 0; i < m->nops; ++i) {
+            const FlowOpCounters *c = &m->slots[s].ops[i];
+            t[i].calls += __atomic_load_n(&c->calls, __ATOMIC_RELAXED);
+            t[i].elems += __atomic_load_n(&c->elems, __ATOMIC_RELAXED);
+            t[i].bytes += __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+            t[i].ns += __atomic_load_n(&c->ns, __ATOMIC_RELAXED);
+        }
+}
+
+int main(int argc, char *argv[]) {
+    double interval = 1.0;
+    long samples = -1;
+    const char *target = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-i") && i + 1 < argc) interval = strtod(argv[++i], NULL);
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) samples = strtol(argv[++i], NULL, 10);
+        else target = argv[i];
+    }
+    if (!target || interval <= 0) {
+        fprintf(stderr, "usage: %s [-i seconds] [-n samples] PID|/shm-name\n", argv[0]);
+        return 2;
+    }
+    char name[64];
+    if (target[0] == '/') snprintf(name, sizeof(name), "%s", target);
+    else snprintf(name, sizeof(name), "/flow.%s", target);
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) { fprintf(stderr, "flow_metrics: no segment %s (is the process built with -DFLOW_METRICS?)\n", name); return 1; }
+    const FlowMetrics *m = (const FlowMetrics *)mmap(NULL, sizeof(FlowMetrics), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) { perror("mmap"); return 1; }
+    if (__atomic_load_n(&m->magic, __ATOMIC_ACQUIRE) != FLOW_METRICS_MAGIC || m->version != FLOW_METRICS_VERSION ||
+        m->nops > FLOW_OP_COUNT || m->nslots > FLOW_METRICS_SLOTS) {
+        fprintf(stderr, "flow_metrics: %s has an incompatible layout (rebuild this tool with the same flow.h)\n", name);
+        return 1;
+    }
+
+    Totals prev[FLOW_OP_COUNT], cur[FLOW_OP_COUNT];
+    sum_slots(m, prev);
+    uint64_t t_prev = _flow_now_ns();
+    for (long k = 0; samples < 0 || k < samples; ++k) {
+        struct timespec ts = { (time_t)interval, (long)((interval - (time_t)interval) * 1e9) };
+        nanosleep(&ts, NULL);
+        if (kill(m->pid, 0) && errno == ESRCH) { fprintf(stderr, "flow_metrics: process %d exited\n", m->pid); break; }
+        sum_slots(m, cur);
+        uint64_t t_cur = _flow_now_ns();
+        double dt = (t_cur - t_prev) / 1e9;
+        printf("pid %d, %u threads, %.2f s\n", m->pid, __atomic_load_n(&m->used, __ATOMIC_RELAXED), dt);
+        printf("  %-14s %12s %14s %12s %7s\n", "op", "calls/s", "Melem/s", "MB/s", "busy%");
+        for (uint32_t i = 0; i < m->nops; ++i) {
+            if (cur[i].calls == prev[i].calls) continue;
+            printf("  %-14.16s %12.0f %14.3f %12.3f %7.1f\n", m->names[i], (cur[i].calls - prev[i].calls) / dt,
+                   (cur[i].elems - prev[i].elems) / dt / 1e6, (cur[i].bytes - prev[i].bytes) / dt / 1e6,
+                   100.0 * (cur[i].ns - prev[i].ns) / 1e9 / dt);
+        }
+        fflush(stdout);
+        memcpy(prev, cur, sizeof(prev));
+        t_prev = t_cur;
+    }
+    return 0;
+}